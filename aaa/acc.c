@@ -8,30 +8,101 @@
 
 #include <aaa/lib.h>
 #include <aaa/prv.h>
+#include <aaa/wire.h>
 
 #include <buffer.h>
 #include <hash.h>
+#include <hindex.h>
+#include <wheel.h>
+#include <spinlock.h>
+
+#include <unistd.h>
 
 #define P_FLAGS (PROT_READ | PROT_WRITE)                                        
-#define M_FLAGS (MAP_PRIVATE | MAP_ANON)
+#define M_FLAGS (MAP_SHARED | MAP_ANON)
 
-#define HTABLE_BITS 9
+#define EXPIRE_BATCH 256
+#define STORE_STRIPES 1024
+#define SESSION_MAGIC 0x5e550004
+#define SESSION_SHIFT 8
+#define SESSION_CLASSES 5
+#define REF_SHIFT 28
+#define REF_MASK ((1U << REF_SHIFT) - 1)
+#define COMMIT_CHANGES 32
 
-DEFINE_HASHTABLE(htable_sid, 9);
-DEFINE_HASHTABLE(htable_bid, 9);
-DEFINE_HASHTABLE(htable_uid, 9);
+/*
+ * The store is mapped by the dispatcher before the workers are forked, all
+ * workers see it at the same address and any worker can serve any session.
+ * Workers restarted by SIGHUP find their sessions in place.
+ *
+ * Sessions are stored as records of 256 bytes up to 4K, every size class 
+ * has its own pool of pages and the record is taken from the smallest class
+ * it fits. The times are kept in the header, the attributes as NUL ended 
+ * values. Well-known attributes (wire.h) are found by their offset in the
+ * header, the others follow them as key and value pairs. The attributes 
+ * of a record are never rewritten, a commit changing them stores a new 
+ * record merged from the old one and the changed attributes and replaces
+ * the old one, so the record changes its class as the session grows or 
+ * shrinks. A commit or touch changing only the times updates them in place.
+ * A reference to the record is its class and page number.
+ *
+ * Sessions are indexed by sess.id, user.id and the binding key (sess.key).
+ * The secondary indexes hold one slot per session, so the sessions of one 
+ * user share the fingerprint and are found by walking its probe sequence.
+ * The indexes are sized for all records and never grow.
+ *
+ * Sessions are expired by a timing wheel with one second ticks advanced by
+ * the worker loop. A session extended after it was queued stays in its slot
+ * and is queued again when the slot fires.
+ *
+ * Locking:
+ *  - the stripe lock selected by the sess.id hash is held by the worker for
+ *    the whole datagram (acct_lock), it serializes requests on one session
+ *  - the store lock protects the indexes, the page allocator and the wheel,
+ *    it is taken inside the stripe lock and only for the update
+ *  - lookups do not take the store lock, they retry when the sequence 
+ *    counter changed during the lookup
+ *
+ * The locks are owned by the worker pid, the dispatcher releases the locks
+ * of a worker which died while holding them (acct_recover).
+ *
+ * With OPENAAA_STORE the pools are mapped from files. Every record is sealed
+ * with its length, generation and a checksum, on startup the pages are read
+ * in one pass and the indexes and the wheel are rebuilt from the records 
+ * which are sealed, intact and not expired, everything else is freed. The
+ * dispatcher flushes the pages every OPENAAA_CHECKPOINT seconds and when
+ * it exits, a crash loses at most the updates since the last checkpoint.
+ */
 
-struct attrs {
-	char sid[128];
-	char uid[32];
+struct store {
+	spinlock lock;
+	seqcount seq;
+	struct pages pools[SESSION_CLASSES];
+	struct hindex index_sid;
+	struct hindex index_uid;
+	struct hindex index_bid;
+	struct wheel wheel;
+	u64 expired;
+	spinlock stripes[STORE_STRIPES];
 };
 
+static struct store *store;
+static size_t store_size;
+static unsigned int owner = 1;
+
+static u64 acct_stats_expired;
+static timestamp_t acct_stats_time;
+static timestamp_t acct_checkpoint_time;
+
+/* share of the store memory in percent for each size class */
+static const unsigned int class_share[SESSION_CLASSES] = { 50, 20, 15, 10, 5 };
+
 struct cursor {
 	timestamp_t now;
 	int expires; 
 	struct bb id;
-	u32 hash;
-	u32 slot;
+	u64 hash;
+	struct session *session;
 };
 
 static timestamp_t
@@ -45,8 +116,8 @@ get_time(void)
 static inline void
 acct_cursor(struct cursor *cursor, struct bb *id, int expires)
 {
-	cursor->hash = hash_buffer(id->addr, id->len);
-	cursor->slot = hash_u32(cursor->hash, HTABLE_BITS);
+	cursor->hash = hindex_fp(hash_buffer(id->addr, id->len));
+	cursor->session = NULL;
 	cursor->expires = expires;
 	memcpy(&cursor->id, id, sizeof(*id));
 	cursor->now = get_time();
@@ -54,46 +125,366 @@ acct_cursor(struct cursor *cursor, struct bb *id, int expires)
 
 struct session {
 	struct page page;
-	struct hnode sid;
-	struct hnode uid;
-	struct hnode bid;
-        timestamp_t created;
-        timestamp_t modified;
-        timestamp_t expires;
-	struct attrs attrs;
-	unsigned char obj[];
+	u32 magic;
+	u32 len;              /* length of obj                             */
+	u64 csum;
+	u64 hash;
+	u64 hash_uid;         /* 0 when user.id is not set                 */
+	u64 hash_bid;         /* 0 when sess.key is not set                */
+	struct wheel_timer timer;
+	timestamp_t created;  /* the times are updated in place, unsealed  */
+	timestamp_t modified;
+	timestamp_t expires;
+	u32 ref;
+	u32 gen;              /* sealed from here to the end of obj        */
+	u16 attr[AAA_ATTR_LAST]; /* offsets of the well-known values or 0,  */
+	                         /* attr[0] is the offset of the key pairs */
+	char obj[];           /* empty string followed by the values       */
 };
 
-struct request {
-	struct bb sid;
-	struct bb uid;
-	struct bb bid;
-	u32  hash_sid;
-	u32  hash_uid;
-	u32  hash_bid;
+/* the store holds @pages of 1 << @shift bytes split into the size classes */
+u32 shift = 12, pages = 100000;
+int aaa_packet_max = (1 << 12) - sizeof(struct session);
+
+static inline void
+store_lock(void)
+{
+	spin_lock_owner(&store->lock, owner);
+	write_seqbegin(&store->seq);
+}
+
+static inline int
+store_trylock(void)
+{
+	if (spin_trylock_owner(&store->lock, owner))
+		return -EBUSY;
+	write_seqbegin(&store->seq);
+	return 0;
+}
+
+static inline void
+store_unlock(void)
+{
+	write_seqend(&store->seq);
+	spin_unlock(&store->lock);
+}
+
+static inline spinlock *
+stripe(u64 hash)
+{
+	return &store->stripes[(hash >> 32) & (STORE_STRIPES - 1)];
+}
+
+static inline struct session *
+session_get(u32 ref)
+{
+	return (struct session *)get_page(&store->pools[ref >> REF_SHIFT], 
+	                                  ref & REF_MASK);
+}
+
+static inline u32
+session_ref(unsigned int class, struct page *page)
+{
+	return (class << REF_SHIFT) | page_index(&store->pools[class], page);
+}
+
+/* the smallest size class the record fits or SESSION_CLASSES */
+static inline unsigned int
+session_class(size_t size)
+{
+	unsigned int class = 0;
+	while (class < SESSION_CLASSES && size > (1U << (SESSION_SHIFT + class)))
+		class++;
+	return class;
+}
+
+static inline u32
+class_pages(unsigned int class)
+{
+	u64 bytes = ((u64)pages << shift) * class_share[class] / 100;
+	return (u32)(bytes >> (SESSION_SHIFT + class));
+}
+
+static inline const char *
+session_val(struct session *session, unsigned int id)
+{
+	return session->obj + session->attr[id];
+}
+
+static inline const char *
+session_sid(struct session *session)
+{
+	return session_val(session, AAA_ATTR_SESS_ID);
+}
+
+static inline u64
+obj_hash(const char *val)
+{
+	return *val ? hindex_fp(hash_buffer(val, strlen(val))): 0;
+}
+
+/* checksum of the generation, the offset table and the values */
+static inline u64
+session_csum(struct session *session)
+{
+	byte *from = (byte *)&session->gen;
+	return hash_buffer(from, (byte *)session->obj + session->len - from);
+}
+
+static inline void
+session_seal(struct session *session)
+{
+	session->csum = session_csum(session);
+	session->magic = SESSION_MAGIC;
+}
+
+static inline int
+session_sealed(struct session *session, unsigned int class)
+{
+	char *obj = session->obj;
+	if (session->magic != SESSION_MAGIC)
+		return 0;
+	if (!session->len || 
+	    session->len > (1U << (SESSION_SHIFT + class)) - sizeof(*session))
+		return 0;
+	for (unsigned int id = 0; id < AAA_ATTR_LAST; id++)
+		if (session->attr[id] > session->len || 
+		    (session->attr[id] && obj[session->attr[id] - 1]))
+			return 0;
+	if (!session->attr[AAA_ATTR_SESS_ID] || obj[0] || obj[session->len - 1])
+		return 0;
+	return session->csum == session_csum(session);
+}
+
+/* the caller holds the store lock */
+static void
+session_link(struct session *session)
+{
+	hindex_add(&store->index_sid, session->hash, session->ref);
+	if (session->hash_uid)
+		hindex_add(&store->index_uid, session->hash_uid, session->ref);
+	if (session->hash_bid)
+		hindex_add(&store->index_bid, session->hash_bid, session->ref);
+	wheel_timer_init(&session->timer);
+	wheel_add(&store->wheel, &session->timer, session->expires);
+}
+
+/* the caller holds the store lock */
+static void
+session_unlink(struct session *session)
+{
+	session->magic = 0;
+	hindex_del(&store->index_sid, session->hash, session->ref);
+	if (session->hash_uid)
+		hindex_del(&store->index_uid, session->hash_uid, session->ref);
+	if (session->hash_bid)
+		hindex_del(&store->index_bid, session->hash_bid, session->ref);
+	wheel_del(&store->wheel, &session->timer);
+	page_free(&store->pools[session->ref >> REF_SHIFT], &session->page);
+}
+
+/*
+ * Index lookups run without the locks, the record may be freed or rewritten
+ * meanwhile. The value is compared only within the bounds of its page, a 
+ * stale result is dropped by the seqcount retry.
+ */
+static int
+match_val(u32 ref, unsigned int id, const char *key)
+{
+	struct session *session = session_get(ref);
+	u32 max = (1U << (SESSION_SHIFT + (ref >> REF_SHIFT))) - sizeof(*session);
+	u32 len = session->len, off = session->attr[id];
+
+	if (session->magic != SESSION_MAGIC || len > max || !off || off >= len)
+		return 0;
+	return !strncmp(key, session->obj + off, len - off);
+}
+
+static int
+match_sid(void *ctx, u32 ref)
+{
+	return match_val(ref, AAA_ATTR_SESS_ID, (const char *)ctx);
+}
+
+struct restore {
+	timestamp_t now;
+	unsigned int class;
 };
 
-static struct pages pagemap;
+/* a session found twice was replaced by a crash, the later one is kept */
+static int
+restore_page(struct page *page, void *ctx)
+{
+	struct session *session = (struct session *)page;
+	struct restore *restore = (struct restore *)ctx;
+
+	if (!session_sealed(session, restore->class) || 
+	    session->expires - restore->now < 1) {
+		session->magic = 0;
+		return 0;
+	}
 
-u32 shift = 12, pages = 100000;
-int aaa_packet_max = (1 << 12) - sizeof(struct session);
+	session->ref = session_ref(restore->class, page);
+	session->hash = obj_hash(session_sid(session));
+	session->hash_uid = obj_hash(session_val(session, AAA_ATTR_USER_ID));
+	session->hash_bid = obj_hash(session_val(session, AAA_ATTR_SESS_KEY));
+
+	u32 ref = hindex_find(&store->index_sid, session->hash, match_sid, 
+	                      (void *)session_sid(session));
+	if (ref != HINDEX_NONE) {
+		struct session *other = session_get(ref);
+		if ((s32)(other->gen - session->gen) > 0) {
+			session->magic = 0;
+			return 0;
+		}
+		session_unlink(other);
+	}
+
+	session_link(session);
+	return 1;
+}
+
+static int
+store_open(const char *name, timestamp_t now)
+{
+	struct restore restore = { .now = now };
+	unsigned int kept = 0;
+
+	for (unsigned int class = 0; class < SESSION_CLASSES; class++) {
+		struct pages *pool = &store->pools[class];
+		unsigned int bits = SESSION_SHIFT + class;
+		const char *file = printfa("%s.%u", name, 1U << bits);
+
+		int rv = pages_open(pool, file, P_FLAGS, bits, class_pages(class));
+		if (rv == -1)
+			die("store %s open failed reason=%s", file, strerror(errno));
+		if (rv == 0)
+			continue;
+
+		restore.class = class;
+		pages_rebuild(pool, restore_page, &restore);
+		kept++;
+	}
+
+	info("store %s restored sessions=%u classes=%u", name, 
+	     store->index_sid.count, kept);
+	return 0;
+}
 
 int
 acct_init(void)
 {
-	if (pages_alloc(&pagemap, P_FLAGS, M_FLAGS, 12, shift, pages))
-		die("pages_alloc() failed reason=%s", strerror(errno));
+	unsigned int bits = 4, total = 0;
+	for (unsigned int class = 0; class < SESSION_CLASSES; class++)
+		total += class_pages(class);
+	while ((1U << bits) < total * 2)
+		bits++;
 
+	size_t slots = sizeof(struct hindex_slot) << bits;
+	store_size = align_to(sizeof(*store), CPU_PAGE_SIZE) + 3 * slots;
+	store = mmap(NULL, store_size, P_FLAGS, M_FLAGS, -1, 0);
+	if (store == MAP_FAILED)
+		die("mmap() failed reason=%s", strerror(errno));
+
+	memset(store, 0, sizeof(*store));
+	byte *mem = (byte *)store + align_to(sizeof(*store), CPU_PAGE_SIZE);
+	hindex_init_fixed(&store->index_sid, bits, mem);
+	hindex_init_fixed(&store->index_uid, bits, mem + slots);
+	hindex_init_fixed(&store->index_bid, bits, mem + 2 * slots);
+
+	timestamp_t now = get_time();
+	wheel_init(&store->wheel, now);
+	acct_stats_time = acct_checkpoint_time = now;
+
+	if (aaad_store)
+		return store_open(aaad_store, now);
+
+	for (unsigned int class = 0; class < SESSION_CLASSES; class++)
+		if (pages_alloc(&store->pools[class], P_FLAGS, M_FLAGS, 12, 
+		                SESSION_SHIFT + class, class_pages(class)))
+			die("pages_alloc() failed reason=%s", strerror(errno));
 	return 0;
 }
 
+/* called by the dispatcher every second */
+void
+acct_checkpoint(void)
+{
+	timestamp_t now = get_time();
+	if (!aaad_store || aaad_checkpoint < 1 ||
+	    now - acct_checkpoint_time < (timestamp_t)aaad_checkpoint)
+		return;
+
+	acct_checkpoint_time = now;
+	for (unsigned int class = 0; class < SESSION_CLASSES; class++)
+		if (pages_sync(&store->pools[class], MS_SYNC))
+			error("store %s sync failed reason=%s", aaad_store, 
+			      strerror(errno));
+}
+
 int
 acct_fini(void)
 {
-	pages_free(&pagemap);
+	for (unsigned int class = 0; class < SESSION_CLASSES; class++)
+		pages_free(&store->pools[class]);
+	munmap(store, store_size);
+	store = NULL;
 	return 0;
 }
 
+/* called by the worker after fork() */
+void
+acct_attach(void)
+{
+	owner = getpid();
+	acct_stats_time = get_time();
+	acct_stats_expired = store->expired;
+}
+
+/*
+ * Releases the locks held by the worker @pid which is gone. A sequence left
+ * odd by the store lock would block the lookups forever.
+ */
+
+void
+acct_recover(pid_t pid)
+{
+	for (unsigned int i = 0; i < STORE_STRIPES; i++)
+		if (spin_unlock_owner(&store->stripes[i], pid))
+			error("released session lock held by pid=%d", pid);
+
+	if (store->lock != (spinlock)pid)
+		return;
+	if (store->seq & 1)
+		write_seqend(&store->seq);
+	if (spin_unlock_owner(&store->lock, pid))
+		error("released store lock held by pid=%d", pid);
+}
+
+/*
+ * Locks the session @sid for the requests of one datagram, returns the lock
+ * handle for acct_unlock().
+ */
+
+int
+acct_lock(const char *sid)
+{
+	if (!sid)
+		return -1;
+
+	u64 hash = hindex_fp(hash_buffer(sid, strlen(sid)));
+	spinlock *lock = stripe(hash);
+	spin_lock_owner(lock, owner);
+	return (int)(lock - store->stripes);
+}
+
+void
+acct_unlock(int handle)
+{
+	if (handle >= 0)
+		spin_unlock(&store->stripes[handle]);
+}
+
 int
 page_copy(struct page *page, struct page *from)
 {
@@ -115,172 +506,423 @@ audit_authentication(struct aaa *aaa, const char *uid)
 
 }
 
-static int 
-session_parse(struct aaa *aaa, byte *buf, unsigned int len)
-{
-	const char *uid1 = aaa_attr_get(aaa, "user.id");
-	const char *uid2 = NULL;
-	len--; 
-	byte *end = buf + len, *a, *b;
-	while (buf < end) {
-		byte *key = buf;
-		while (buf < end && *buf != ':' && *buf != '\n')
-			buf++;
-		if (buf >= end)
-			goto finish;
-		if (*buf != ':')
-			goto finish;
-		a = buf;
-		*buf++ = 0;
-		byte *value = buf;
-		while (buf < end && *buf != '\n')
-			buf++;
-		if (buf >= end)
-			goto finish;
-		b = buf;
-		*buf++ = 0;
-
-		struct attr *attr = dict_lookup(&aaa->attrs, key, 0);
-		if (!strcmp(key, "user.id"))
-			uid2 = value;
-
-		if (attr && (attr->flags & ATTR_CHANGED)) {
-			debug3("parse %s:<%s> changed", attr->key, attr->val);
-		} else {
-			debug3("parse %s:<%s>", key, value);
-			dict_set_nf(&aaa->attrs, key, value);
-		}
-		*a = ':';
-		*b = '\n';
+static inline void
+session_attr(struct attr *a, char *val)
+{
+	debug3("read %s:<%s>", a->key, val);
+	if (!(a->flags & ATTR_CHANGED))
+		a->val = val;
+}
 
-	}
-	*buf++ = 0;
-finish:
-	if (!uid2 && uid1)
-		audit_authentication(aaa, uid1);
-	
-	return len;
+static inline struct attr *
+session_known(struct aaa *aaa, unsigned int id)
+{
+	return dict_lookup_sym(&aaa->attrs, aaa_wire_attr_sym(id), 1);
 }
 
-int
-session_read(struct aaa *aaa, struct session *session)
+/* the other keys are interned when known, referenced in the copy otherwise */
+static inline struct attr *
+session_key(struct aaa *aaa, char *key)
 {
-	return session_parse(aaa, session->obj, (1<<shift) - sizeof(*session));
+	const struct dict_sym *sym = aaa_attr_intern(key, strlen(key), 0);
+	if (sym)
+		return dict_lookup_sym(&aaa->attrs, sym, 1);
+
+	struct dict_sym ref = { .key = key, .hash = dict_hash(key) };
+	return dict_lookup_sym(&aaa->attrs, &ref, 1);
 }
 
-static int
-attr_enc(byte *buf, int len, int maxlen, const char *key, const char *val)
+static inline char *
+session_time(struct aaa *aaa, unsigned int id, char *buf, timestamp_t time)
 {
-	if (len < 0)
-		return len;
+	session_attr(session_known(aaa, id), buf);
+	return buf + sprintf(buf, "%lld", (long long int)time) + 1;
+}
+
+/*
+ * The record is copied to the aaa pool once and the attributes reference 
+ * their values in the copy, the record itself is replaced by the next 
+ * commit. Attributes set by the request in progress take precedence.
+ */
+
+int
+session_read(struct aaa *aaa, struct session *session)
+{
+	const char *uid = aaa_attr_get(aaa, "user.id");
+	if (uid && !*session_val(session, AAA_ATTR_USER_ID))
+		audit_authentication(aaa, uid);
+
+	char *obj = mm_alloc(aaa->attrs.mm, session->len + 3 * 24);
+	char *end = obj + session->len, *buf = end;
+	memcpy(obj, session->obj, session->len);
+
+	for (unsigned int id = 1; id < AAA_ATTR_LAST; id++)
+		if (session->attr[id])
+			session_attr(session_known(aaa, id), obj + session->attr[id]);
 
-	int klen = strlen(key), vlen = strlen(val);
-	int linelen = klen + 1 + vlen + 1;
+	buf = session_time(aaa, AAA_ATTR_SESS_CREATED, buf, session->created);
+	buf = session_time(aaa, AAA_ATTR_SESS_MODIFIED, buf, session->modified);
+	buf = session_time(aaa, AAA_ATTR_SESS_EXPIRES, buf, session->expires);
 
-	if (len + linelen > maxlen)
+	for (char *key = obj + session->attr[AAA_ATTR_KEY]; key < end; ) {
+		char *val = key + strlen(key) + 1;
+		session_attr(session_key(aaa, key), val);
+		key = val + strlen(val) + 1;
+	}
+
+	return session->len;
+}
+
+static inline int
+obj_put(char *buf, int len, int size, const char *val)
+{
+	int vlen = strlen(val);
+	if (len < 0 || len + vlen + 1 > size)
 		return -1;
-	buf += len;
-	memcpy(buf, key, klen);
-	buf += klen;
-	*buf++ = ':';
-	memcpy(buf, val, vlen);
-	buf += vlen;
-	*buf = '\n';
-	return linelen;
+	memcpy(buf + len, val, vlen + 1);
+	return len + vlen + 1;
 }
 
 static inline int
-session_build(struct aaa *aaa, byte *buf, int size)
+session_timed(unsigned int id)
 {
-	memset(buf, 0, size);
-	int len = 0;
+	return id == AAA_ATTR_SESS_CREATED || id == AAA_ATTR_SESS_MODIFIED ||
+	       id == AAA_ATTR_SESS_EXPIRES;
+}
+
+/* the times are kept in the header, sess.id comes from the cursor */
+static int
+session_build(struct aaa *aaa, const char *sid, struct session *session, 
+              char *buf, int size)
+{
+	memset(session->attr, 0, sizeof(session->attr));
+	buf[0] = 0;
+	session->attr[AAA_ATTR_SESS_ID] = 1;
+	int len = obj_put(buf, 1, size, sid);
+
 	dict_for_each(a, aaa->attrs.list) {
 		if (!a->val || !*a->val)
 			continue;
-		len += attr_enc(buf, len, size, a->key, a->val);
+		unsigned int id = aaa_attr_id(a);
+		if (id == AAA_ATTR_KEY || id == AAA_ATTR_SESS_ID || session_timed(id))
+			continue;
+		session->attr[id] = len;
+		len = obj_put(buf, len, size, a->val);
+		debug2("build %s:%s", a->key, a->val);
+	}
+
+	session->attr[AAA_ATTR_KEY] = len;
+	dict_for_each(a, aaa->attrs.list) {
+		if (!a->val || !*a->val)
+			continue;
+		if (aaa_attr_id(a) != AAA_ATTR_KEY)
+			continue;
+		len = obj_put(buf, len, size, a->key);
+		len = obj_put(buf, len, size, a->val);
 		debug2("build %s:%s", a->key, a->val);
-		if (len > size)
-			return -EINVAL;
 	}
+
+	if (len < 0 || len > 0xffff)
+		return -EINVAL;
+
 	debug2("build session size: %d", len);
 	return len;
 }
 
-static int
-session_write(struct aaa *aaa, struct session *session)
+/*
+ * Stores the session as a new record of the smallest class it fits and 
+ * replaces the record @old. The old record stays sealed until the new one
+ * is, a crash in between leaves both and the restore keeps the later one.
+ */
+
+static struct session *
+session_store(struct cursor *sid, struct session *old, struct session *hdr,
+              char *obj, int len)
 {
-	return session_build(aaa, session->obj, (1<<shift) - sizeof(*session));
+	unsigned int class = session_class(sizeof(*hdr) + len);
+	if (class == SESSION_CLASSES)
+		return NULL;
+
+	store_lock();
+	struct page *page = page_alloc(&store->pools[class]);
+	store_unlock();
+	if (!page)
+		return NULL;
+
+	struct session *session = (struct session *)page;
+	session->magic    = 0;
+	session->len      = len;
+	session->ref      = session_ref(class, page);
+	session->gen      = old ? old->gen + 1: 0;
+	session->created  = hdr->created;
+	session->modified = hdr->modified;
+	session->expires  = hdr->expires;
+	memcpy(session->attr, hdr->attr, sizeof(hdr->attr));
+	memcpy(session->obj, obj, len);
+
+	session->hash     = sid->hash;
+	session->hash_uid = obj_hash(session_val(session, AAA_ATTR_USER_ID));
+	session->hash_bid = obj_hash(session_val(session, AAA_ATTR_SESS_KEY));
+	session_seal(session);
+
+	store_lock();
+	if (old)
+		session_unlink(old);
+	session_link(session);
+	store_unlock();
+	return session;
 }
 
-static void
-expired(struct session *session)
+struct changes {
+	struct attr *known[AAA_ATTR_LAST];
+	struct attr *other[COMMIT_CHANGES];
+	unsigned int count;
+	unsigned int others;
+};
+
+static const char *
+session_other(struct session *session, const char *key)
 {
-	debug3("session id=%s expired.", session->attrs.sid);
-	hash_del(&session->sid);
-	memset(((u8*)session) + sizeof(*session), 0, (1 << shift) - sizeof(*session));
-	page_free(&pagemap, (struct page *)session);
+	const char *end = session->obj + session->len;
+	for (const char *it = session_val(session, AAA_ATTR_KEY); it < end; ) {
+		const char *val = it + strlen(it) + 1;
+		if (!strcmp(it, key))
+			return val;
+		it = val + strlen(val) + 1;
+	}
+	return "";
 }
 
+/*
+ * Collects the attributes changed by the request which differ from the 
+ * stored ones, sess.id and the times are not attributes of the record. 
+ * Returns the number of changes or -1 when there are too many of them.
+ */
+
 static int
-lookup(struct aaa *aaa, struct cursor *sid)
+session_changes(struct aaa *aaa, struct session *session, struct changes *c)
 {
-	struct session *session = NULL;
-	int rv = -1;
-	hash_walk_delsafe(htable_sid, sid->slot, session, sid) {
-		int exp = session->expires - sid->now;
-		if (exp < 1) {
-			expired(session);
+	memset(c, 0, sizeof(*c));
+	dict_for_each(a, aaa->attrs.list) {
+		if (!(a->flags & ATTR_CHANGED))
 			continue;
+
+		const char *val = a->val ? a->val: "";
+		unsigned int id = aaa_attr_id(a);
+		if (id == AAA_ATTR_SESS_ID || session_timed(id))
+			continue;
+		if (id != AAA_ATTR_KEY) {
+			if (!strcmp(val, session_val(session, id)))
+				continue;
+			c->known[id] = a;
+		} else {
+			if (!strcmp(val, session_other(session, a->key)))
+				continue;
+			if (c->others == COMMIT_CHANGES)
+				return -1;
+			c->other[c->others++] = a;
 		}
+		c->count++;
+	}
 
-		if (rv == 0)
+	return c->count;
+}
+
+static inline int
+session_changed(struct changes *c, const char *key)
+{
+	for (unsigned int i = 0; i < c->others; i++)
+		if (!strcmp(c->other[i]->key, key))
+			return 1;
+	return 0;
+}
+
+/* the new record is the old one with the changes applied */
+static int
+session_merge(struct session *session, struct changes *c, struct session *hdr,
+              char *buf, int size)
+{
+	memset(hdr->attr, 0, sizeof(hdr->attr));
+	buf[0] = 0;
+	hdr->attr[AAA_ATTR_SESS_ID] = 1;
+	int len = obj_put(buf, 1, size, session_sid(session));
+
+	for (unsigned int id = 1; id < AAA_ATTR_LAST; id++) {
+		if (id == AAA_ATTR_SESS_ID || session_timed(id))
 			continue;
+		const char *val = session_val(session, id);
+		if (c->known[id])
+			val = c->known[id]->val ? c->known[id]->val: "";
+		if (!*val)
+			continue;
+		hdr->attr[id] = len;
+		len = obj_put(buf, len, size, val);
+	}
 
-		if (strcmp(sid->id.addr, session->attrs.sid))
+	hdr->attr[AAA_ATTR_KEY] = len;
+	const char *end = session->obj + session->len;
+	for (const char *it = session_val(session, AAA_ATTR_KEY); it < end; ) {
+		const char *val = it + strlen(it) + 1;
+		if (!session_changed(c, it)) {
+			len = obj_put(buf, len, size, it);
+			len = obj_put(buf, len, size, val);
+		}
+		it = val + strlen(val) + 1;
+	}
+
+	for (unsigned int i = 0; i < c->others; i++) {
+		struct attr *a = c->other[i];
+		if (!a->val || !*a->val)
 			continue;
+		len = obj_put(buf, len, size, a->key);
+		len = obj_put(buf, len, size, a->val);
+	}
 
-		debug3("session id=%s attached.", session->attrs.sid);
-		session_read(aaa, session);
-		rv = 0;
+	if (len < 0 || len > 0xffff)
+		return -EINVAL;
+	return len;
+}
+
+/* the caller holds the stripe lock, the timer is moved only when earlier */
+static void
+session_times(struct session *session, timestamp_t modified, 
+              timestamp_t expires)
+{
+	session->modified = modified;
+	session->expires  = expires;
+	if (expires >= session->timer.expires)
+		return;
+
+	store_lock();
+	wheel_mod(&store->wheel, &session->timer, expires);
+	store_unlock();
+}
+
+/* the caller holds the stripe and the store lock */
+static void
+expired(struct session *session)
+{
+	debug3("session id=%s expired.", session_sid(session));
+	session_unlink(session);
+	store->expired++;
+}
+
+static struct session *
+find(struct cursor *sid)
+{
+	u32 ref;
+	unsigned int seq;
+	do {
+		seq = read_seqbegin(&store->seq);
+		ref = hindex_find(&store->index_sid, sid->hash, match_sid, 
+		                  sid->id.addr);
+	} while (read_seqretry(&store->seq, seq));
+
+	if (ref == HINDEX_NONE)
+		return NULL;
+
+	struct session *session = session_get(ref);
+	if (session->expires - sid->now < 1) {
+		store_lock();
+		expired(session);
+		store_unlock();
+		return NULL;
 	}
 
-	return rv;
+	return session;
+}
+
+static int
+match_bid(void *ctx, u32 ref)
+{
+	return match_val(ref, AAA_ATTR_SESS_KEY, (const char *)ctx);
+}
+
+/* the session belongs to another stripe, expired ones are left to the wheel */
+static struct session *
+find_bid(const char *key, timestamp_t now)
+{
+	u64 hash = obj_hash(key);
+	u32 ref;
+	unsigned int seq;
+	do {
+		seq = read_seqbegin(&store->seq);
+		ref = hindex_find(&store->index_bid, hash, match_bid, (void *)key);
+	} while (read_seqretry(&store->seq, seq));
+
+	if (ref == HINDEX_NONE)
+		return NULL;
+
+	struct session *session = session_get(ref);
+	return session->expires - now < 1 ? NULL: session;
+}
+
+static int
+lookup(struct aaa *aaa, struct cursor *sid)
+{
+	struct session *session;
+	if (!(session = find(sid)))
+		return -1;
+
+	debug3("session id=%s attached.", session_sid(session));
+	session_read(aaa, session);
+	sid->session = session;
+	return 0;
 }
 
+/*
+ * Value set operations of the request apply to the stored values, the 
+ * attributes changed only by them are rebased on the record first.
+ */
+
 static void
-set_id(struct session *session, struct cursor *id)
+session_values(struct aaa *aaa, struct session *session)
 {
-	strncpy(session->attrs.sid, id->id.addr, sizeof(session->attrs.sid)-1);
+	struct aaa_value_op *v;
+	if (dlist_empty(&aaa->values))
+		return;
+
+	dict_for_each(a, aaa->attrs.list) {
+		if (!(a->flags & ATTR_VALUES))
+			continue;
+		unsigned int id = aaa_attr_id(a);
+		const char *val = !session ? "": id != AAA_ATTR_KEY ? 
+		                  session_val(session, id): 
+		                  session_other(session, a->key);
+		a->val = mm_strdup(aaa->attrs.mm, val);
+	}
+
+	dlist_walk(aaa->values, v, node)
+		if (v->attr->flags & ATTR_VALUES)
+			dict_vals_update(&aaa->attrs, v->attr, v->val, v->del);
 }
 
 static int
 create(struct aaa *aaa, struct cursor *sid)
 {
-	struct page *page = NULL;
-	if (!(page = page_alloc(&pagemap)))
-		goto cleanup;
+	timestamp_t expires = sid->now + sid->expires;
+	aaa_attr_set(aaa, "sess.id", (char *)sid->id.addr);
+	aaa_attr_set(aaa, "sess.created",  printfa("%lld", (long long int)sid->now));
+	aaa_attr_set(aaa, "sess.modified", printfa("%lld", (long long int)sid->now));
+	aaa_attr_set(aaa, "sess.expires",  printfa("%lld", (long long int)expires));
 
-	struct session *session = (struct session *)page;
-	memset(((u8*)session) + sizeof(*session), 0, (1 << shift) - sizeof(*session)); 
-	session->created = session->modified = sid->now;
-	session->expires = session->created + sid->expires;
+	session_values(aaa, NULL);
 
-	set_id(session, sid);
-	aaa_attr_set(aaa, "sess.id", (char *)sid->id.addr);
-	aaa_attr_set(aaa, "sess.created",  printfa("%lld", (long long int)session->created));
-	aaa_attr_set(aaa, "sess.modified", printfa("%lld", (long long int)session->modified));
-	aaa_attr_set(aaa, "sess.expires",  printfa("%lld", (long long int)session->expires));
+	char obj[1 << 12];
+	struct session hdr;
+	int len = session_build(aaa, sid->id.addr, &hdr, obj, sizeof(obj));
+	if (len < 0)
+		return -EINVAL;
 
-	if (session_write(aaa, session) < 0)
-		goto cleanup;
-	hash_add(htable_sid, &session->sid, sid->slot);
+	struct session *session;
+	hdr.created = hdr.modified = sid->now;
+	hdr.expires = expires;
+	if (!(session = session_store(sid, NULL, &hdr, obj, len)))
+		return -EINVAL;
 
-	debug3("session id=%s created.", session->attrs.sid);
+	sid->session = session;
+	debug3("session id=%s created.", session_sid(session));
 	return 0;
-cleanup:
-	if (page)
-		page_free(&pagemap, page);
-	return -EINVAL;
 }
 
 int
@@ -290,7 +932,7 @@ session_bind(struct aaa *aaa, const char *id)
 	struct bb sid = { .addr = (void *)id, .len = strlen(id) };
 	acct_cursor(&csid, &sid, aaa->timeout);
 
-        debug3("bind() id=%s slot=%d", sid.addr, (int)csid.slot);
+	debug3("bind() id=%s hash=%jx", sid.addr, (uintmax_t)csid.hash);
 	if (!(lookup(aaa, &csid)))
 		return 0;
 	if (!(create(aaa, &csid)))
@@ -299,45 +941,152 @@ session_bind(struct aaa *aaa, const char *id)
 	return -EINVAL;
 }
 
+/*
+ * Reads the session without creating or extending it. A session unknown by
+ * sess.id is looked up by its binding key, a resumed tls session may come 
+ * with a new session id bound to the same keying material.
+ */
+
 int
 session_select(struct aaa *aaa, const char *id)
 {
-	return -EINVAL;
+	struct cursor csid;
+	struct bb sid = { .addr = (void *)id, .len = strlen(id) };
+	acct_cursor(&csid, &sid, aaa->timeout);
+
+	debug3("select() id=%s hash=%jx", sid.addr, (uintmax_t)csid.hash);
+	if (!(lookup(aaa, &csid)))
+		return 0;
+
+	struct session *session;
+	const char *key = aaa_attr_get(aaa, "sess.key");
+	if (!key || !*key || !(session = find_bid(key, csid.now)))
+		return -EINVAL;
+
+	/* the session may be served by other worker right now */
+	spinlock *lock = stripe(session->hash);
+	if (lock != stripe(csid.hash) && spin_trylock_owner(lock, owner))
+		return -EBUSY;
+
+	/* and replaced by a commit before the lock was taken */
+	int rv = -EINVAL;
+	if ((session = find_bid(key, csid.now)) && stripe(session->hash) == lock) {
+		debug3("session id=%s attached by key.", session_sid(session));
+		session_read(aaa, session);
+		rv = 0;
+	}
+
+	if (lock != stripe(csid.hash))
+		spin_unlock(lock);
+	return rv;
 }
 
+struct listing {
+	struct aaa *aaa;
+	const char *uid;
+	timestamp_t now;
+	unsigned int count;
+	unsigned int listed;
+	int size;
+};
+
+static int
+list_session(void *ctx, u32 ref)
+{
+	struct listing *list = (struct listing *)ctx;
+	struct session *session = session_get(ref);
+
+	if (strcmp(list->uid, session_val(session, AAA_ATTR_USER_ID)))
+		return 0;
+	if (session->expires - list->now < 1)
+		return 0;
+
+	list->count++;
+	list->size += strlen(session_sid(session)) + 20;
+	if (list->size > aaa_packet_max / 2)
+		return 0;
+
+	const char *key = printfa("user.session.%u", list->listed);
+	aaa_attr_set(list->aaa, key, session_sid(session));
+	list->listed++;
+	return 0;
+}
+
+/*
+ * Lists the live sessions of user.id as user.session.0 .. user.session.N-1 
+ * and their count as user.sessions. The list is cut to fit the reply, the 
+ * count includes the sessions left out.
+ */
+
+int
+session_list(struct aaa *aaa)
+{
+	const char *uid = aaa_attr_get(aaa, "user.id");
+	if (!uid || !*uid)
+		return -EINVAL;
+
+	struct listing list = {
+		.aaa = aaa, .uid = uid, .now = get_time()
+	};
+
+	u64 hash = obj_hash(uid);
+	spin_lock_owner(&store->lock, owner);
+	hindex_walk(&store->index_uid, hash, list_session, &list);
+	spin_unlock(&store->lock);
+
+	debug3("list() uid=%s sessions=%u", uid, list.count);
+	aaa_attr_set(aaa, "user.sessions", printfa("%u", list.count));
+	return 0;
+}
+
+/*
+ * Only the attributes changed by the request are applied, a commit which 
+ * changes none of them just updates the times in place. More changes than
+ * COMMIT_CHANGES rebuild the record from all attributes of the request.
+ */
+
 static int
 commit(struct aaa *aaa, struct cursor *sid)
 {
-	struct session *session = NULL;
-	int rv = -1;
-	hash_walk_delsafe(htable_sid, sid->slot, session, sid) {
-		int exp = session->expires - sid->now;
-                debug4("sess id=%s expires in %d sec(s)", session->attrs.sid, exp);
-		if (exp < 1) {
-			expired(session);
-			continue;
-		}
+	struct session *session = sid->session;
+	if (!session && !(session = find(sid)))
+		return -1;
 
-		if (rv == 0)
-			continue;
-		if (strcmp(sid->id.addr, session->attrs.sid))
-			continue;
+	const char *modified = aaa_attr_get(aaa, "sess.modified");
+	const char *expires  = aaa_attr_get(aaa, "sess.expires");
 
-		const char *modified = aaa_attr_get(aaa, "sess.modified");
-		const char *expires  = aaa_attr_get(aaa, "sess.expires");
+	if (!modified || !expires)
+		return -1;
 
-		if (!modified || !expires)
-			continue;
+	struct session hdr;
+	hdr.created  = session->created;
+	hdr.modified = strtol(modified, NULL, 10);
+	hdr.expires  = strtol(expires, NULL, 10);
 
-		session->modified = strtol(modified, NULL, 10);
-		session->expires  = strtol(expires, NULL, 10);
+	session_values(aaa, session);
 
-		session_write(aaa, session);
-		debug2("session id=%s commited.", session->attrs.sid);
-		rv = 0;
+	struct changes changes;
+	int len, count = session_changes(aaa, session, &changes);
+	if (!count) {
+		session_times(session, hdr.modified, hdr.expires);
+		debug2("session id=%s touched.", session_sid(session));
+		return 0;
 	}
 
-	return rv;
+	char obj[1 << 12];
+	if (count > 0)
+		len = session_merge(session, &changes, &hdr, obj, sizeof(obj));
+	else
+		len = session_build(aaa, sid->id.addr, &hdr, obj, sizeof(obj));
+	if (len < 0)
+		return -1;
+
+	if (!(session = session_store(sid, session, &hdr, obj, len)))
+		return -1;
+
+	sid->session = session;
+	debug2("session id=%s commited.", session_sid(session));
+	return 0;
 }
 
 int
@@ -347,14 +1096,14 @@ session_commit(struct aaa *aaa, const char *id)
 	struct bb sid = { .addr = (void *)id, .len = strlen(id) };
 	acct_cursor(&csid, &sid, aaa->timeout);
 
-	debug3("commit() id=%s slot=%u processing", sid.addr, (unsigned int)csid.slot);
+	debug3("commit() id=%s hash=%jx processing", sid.addr, (uintmax_t)csid.hash);
 
 	if (lookup(aaa, &csid))
 		goto failed;
 
 	return commit(aaa, &csid);
 failed:
-	debug3("commit() id=%s slot=%u failed", sid.addr, (unsigned int)csid.slot);
+	debug3("commit() id=%s failed", sid.addr);
 	return -EINVAL;	
 }
 
@@ -365,9 +1114,73 @@ session_touch(struct aaa *aaa, const char *id)
 	struct bb sid = { .addr = (void *)id, .len = strlen(id) };
 	acct_cursor(&csid, &sid, aaa->timeout);
 
-	debug3("touch id=%s hash=%d slot=%d", sid.addr, csid.hash, csid.slot);
+	debug3("touch id=%s hash=%jx", sid.addr, (uintmax_t)csid.hash);
 	if (lookup(aaa, &csid))
 		return -EINVAL;
 
+	/* extends the session unless the client sent its own times */
+	struct attr *attr = dict_lookup(&aaa->attrs, "sess.expires", 0);
+	if (!attr || !(attr->flags & ATTR_CHANGED)) {
+		timestamp_t expires = csid.now + csid.expires;
+		aaa_attr_set(aaa, "sess.modified", printfa("%lld", (long long int)csid.now));
+		aaa_attr_set(aaa, "sess.expires",  printfa("%lld", (long long int)expires));
+	}
+
 	return commit(aaa, &csid);
 }
+
+/* sessions served by other worker right now are retried the next tick */
+static void
+timer_expired(void *ctx, struct wheel_timer *timer)
+{
+	struct session *session = __container_of(timer, struct session, timer);
+	timestamp_t now = *(timestamp_t *)ctx;
+
+	if (session->expires > now) {
+		wheel_add(&store->wheel, timer, session->expires);
+		return;
+	}
+
+	spinlock *lock = stripe(session->hash);
+	if (spin_trylock_owner(lock, owner)) {
+		wheel_add(&store->wheel, timer, now + 1);
+		return;
+	}
+
+	expired(session);
+	spin_unlock(lock);
+}
+
+/*
+ * Expires at most EXPIRE_BATCH sessions per call, the rest are left for the
+ * next call. Only one worker runs the wheel at a time, the others skip it.
+ * Returns the number of timers processed.
+ */
+
+int
+acct_expire(void)
+{
+	timestamp_t now = get_time();
+	if (now < store->wheel.base || store_trylock())
+		return 0;
+
+	int count = wheel_run(&store->wheel, now, EXPIRE_BATCH, timer_expired, &now);
+	store_unlock();
+	return count;
+}
+
+/* the rate is averaged over the time since the previous call */
+void
+acct_stats(struct acct_stats *stats)
+{
+	timestamp_t now = get_time();
+	u64 expired = store->expired - acct_stats_expired;
+
+	stats->live    = store->index_sid.count;
+	stats->expired = store->expired;
+	stats->rate    = now > acct_stats_time ? 
+	                 (double)expired / (now - acct_stats_time): 0;
+
+	acct_stats_expired = store->expired;
+	acct_stats_time = now;
+}
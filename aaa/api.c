@@ -2,22 +2,34 @@
 #include <sys/cpu.h>
 #include <sys/log.h>
 #include <list.h>
+#include <atomic.h>
 #include <mem/pool.h>
+#include <mem/slab.h>
 #include <aaa/lib.h>
 #include <aaa/prv.h>
 #include <dict.h>
 
+#include <stdlib.h>
+#include <pthread.h>
+
 static int aaa_initialized = 0;
 
 int (*aaa_server)(int argc, char *argv[]) = NULL;
 
+void
+aaa_lib_init(void)
+{
+	if (aaa_initialized)
+		return;
+
+	aaa_env_init();
+	aaa_initialized = 1;
+}
+
 struct aaa *
 aaa_new(enum aaa_endpoint type, int flags)
 {
-	if (!aaa_initialized) {
-		aaa_env_init();
-		aaa_initialized = 1;
-	}
+	aaa_lib_init();
 
 	struct mm_pool *mp = mm_pool_create(CPU_PAGE_SIZE, 0);
 	struct aaa *aaa = mm_pool_zalloc(mp, sizeof(*aaa));
@@ -26,8 +38,12 @@ aaa_new(enum aaa_endpoint type, int flags)
 	aaa->mp_attrs = mm_pool_create(CPU_PAGE_SIZE, 0);
 	aaa->attrs_it = NULL;
 	aaa->timeout = AAA_SESSION_EXPIRES;
+	aaa->fd = -1;
+	aaa->timeout_ms = aaad_timeout;
+	aaa->retransmit_ms = aaad_retransmit;
 
 	dict_init(&aaa->attrs, mm_pool(aaa->mp_attrs));
+	dlist_init(&aaa->values);
 	debug1("%s() aaa: %p", __func__, aaa);
 	return aaa;
 }
@@ -36,6 +52,7 @@ void
 aaa_free(struct aaa *aaa)
 {
 	debug1("%s() aaa: %p", __func__, aaa);
+	udp_close(aaa);
 	mm_pool_destroy(aaa->mp_attrs);
 	mm_pool_destroy(aaa->mp);
 }
@@ -46,6 +63,21 @@ aaa_set_timeout(struct aaa *aaa, int timeout)
 	aaa->timeout = timeout;
 }
 
+int
+aaa_set_opt(struct aaa *aaa, enum aaa_opt_e opt, int value)
+{
+	switch (opt) {
+	case AAA_OPT_TIMEOUT:
+		aaa->timeout_ms = value > 0 ? value: aaad_timeout;
+		return 0;
+	case AAA_OPT_RETRANSMIT:
+		aaa->retransmit_ms = value > 0 ? value: aaad_retransmit;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 int
 aaa_bind(struct aaa *aaa)
 {
@@ -64,6 +96,7 @@ aaa_reset(struct aaa *aaa)
 	debug1("%s() aaa: %p", __func__, aaa);
 	mm_pool_flush(aaa->mp_attrs);
 	dict_init(&aaa->attrs, mm_pool(aaa->mp_attrs));
+	dlist_init(&aaa->values);
 	aaa->attrs_it = NULL;
 }
 
@@ -73,14 +106,39 @@ aaa_reset(struct aaa *aaa)
  * IP header and the 8-byte UDP header.
  */
 
+/*
+ * Attributes with interned names reference the name, the others own a copy
+ * of it in the attribute pool.
+ */
+
+static inline struct attr *
+attr_lookup(struct dict *dict, const char *key, unsigned int len, int create)
+{
+	const struct dict_sym *sym = aaa_attr_intern(key, len, create == 1);
+	if (sym)
+		return dict_lookup_sym(dict, sym, !!create);
+	return dict_lookup(dict, key, !!create);
+}
+
+struct attr *
+aaa_attr_lookup(struct aaa *aaa, const char *key, unsigned int len, int create)
+{
+	return attr_lookup(&aaa->attrs, key, len, create);
+}
+
 int
 aaa_attr_set(struct aaa *aaa, const char *name, const char *value)
 {
 	debug1("%s() aaa: %p, %s: <%s>", __func__, aaa, name, value);
-	if (!name || !value || strlen(value) > 255 || strlen(name) > 64)
+	size_t len = name ? strlen(name): 0;
+	if (!name || !value || strlen(value) > 255 || len > 64)
+		return -EINVAL;
+	if (aaa_value_op_key(name, len))
 		return -EINVAL;
 
-	dict_set(&aaa->attrs, name, value);
+	struct attr *a = aaa_attr_lookup(aaa, name, len, 1);
+	a->val = mm_strdup(aaa->attrs.mm, value);
+	a->flags = (a->flags | ATTR_CHANGED) & ~ATTR_VALUES;
 	return 0;
 }
 
@@ -88,20 +146,68 @@ const char *
 aaa_attr_get(struct aaa *aaa, const char *attr)
 {
 	debug1("%s() aaa: %p attr: %s", __func__, aaa, attr);
+	if (!attr)
+		return NULL;
 
-	return attr ? dict_get(&aaa->attrs, attr): NULL;
+	struct attr *a = aaa_attr_lookup(aaa, attr, strlen(attr), 0);
+	return a ? a->val: NULL;
+}
+
+static inline int
+valid_value(const char *key, const char *val)
+{
+	if (!key || !val || !*val || strlen(key) > 64 || strlen(val) > 255)
+		return 0;
+	return !aaa_value_op_key(key, strlen(key)) && !strchr(val, ' ');
+}
+
+int
+aaa_value_op(struct aaa *aaa, struct attr *a, const char *val, int del)
+{
+	struct aaa_value_op *op = mm_alloc(aaa->attrs.mm, sizeof(*op));
+
+	op->attr = a;
+	op->val  = mm_strdup(aaa->attrs.mm, val);
+	op->del  = del;
+	dlist_add_tail(&aaa->values, &op->node);
+
+	if (!(a->flags & ATTR_CHANGED))
+		a->flags |= ATTR_VALUES;
+	a->flags |= ATTR_CHANGED;
+	dict_vals_update(&aaa->attrs, a, op->val, del);
+	return 0;
+}
+
+int
+aaa_attr_add_value(struct aaa *aaa, const char *key, const char *val)
+{
+	debug1("%s() aaa: %p, %s: <%s>", __func__, aaa, key, val);
+	if (!valid_value(key, val))
+		return -EINVAL;
+
+	struct attr *a = aaa_attr_lookup(aaa, key, strlen(key), 1);
+	return aaa_value_op(aaa, a, val, 0);
 }
 
 int
 aaa_attr_del_value(struct aaa *aaa, const char *key, const char *val)
 {
-	return -1;
+	debug1("%s() aaa: %p, %s: <%s>", __func__, aaa, key, val);
+	if (!valid_value(key, val))
+		return -EINVAL;
+
+	struct attr *a = aaa_attr_lookup(aaa, key, strlen(key), 1);
+	return aaa_value_op(aaa, a, val, 1);
 }
 
 int
 aaa_attr_has_value(struct aaa *aaa, const char *key, const char *val)
 {
-	return -1;
+	if (!valid_value(key, val))
+		return -EINVAL;
+
+	struct attr *a = aaa_attr_lookup(aaa, key, strlen(key), 0);
+	return a ? dict_has_value(&aaa->attrs, a, val): 0;
 }
 
 const char *
@@ -153,6 +259,121 @@ aaa_attr_dump(struct aaa *aaa, const char *path)
 	}
 }
 
+/*
+ * The view takes over the attribute pool instead of copying the attributes,
+ * the context continues with the flushed pool of a recycled view. Views are
+ * recycled through a per-thread slab, a view released by another thread
+ * goes to the slab of that thread.
+ */
+
+#define AAA_VIEW_SLAB 64
+
+static pthread_key_t view_key;
+static pthread_once_t view_once = PTHREAD_ONCE_INIT;
+static __thread struct mem_slab *view_slab;
+
+static void
+view_free(void *obj)
+{
+	struct aaa_view *view = obj;
+	if (view->mp)
+		mm_pool_destroy(view->mp);
+}
+
+static void
+view_slab_free(void *slab)
+{
+	mem_slab_destroy(slab);
+	free(slab);
+	view_slab = NULL;
+}
+
+static void
+view_slab_init(void)
+{
+	pthread_key_create(&view_key, view_slab_free);
+}
+
+static struct mem_slab *
+view_slab_get(void)
+{
+	if (view_slab)
+		return view_slab;
+
+	pthread_once(&view_once, view_slab_init);
+	view_slab = malloc(sizeof(*view_slab));
+	if (!view_slab)
+		die("Can not allocate memory size=%jd", (intmax_t)sizeof(*view_slab));
+
+	mem_slab_init(view_slab, sizeof(struct aaa_view), AAA_VIEW_SLAB, view_free);
+	pthread_setspecific(view_key, view_slab);
+	return view_slab;
+}
+
+struct aaa_view *
+aaa_view(struct aaa *aaa)
+{
+	struct aaa_view *view = mem_slab_alloc(view_slab_get());
+	struct mm_pool *mp = view->mp ? view->mp: mm_pool_create(CPU_PAGE_SIZE, 0);
+
+	view->mp = aaa->mp_attrs;
+	view->refs = 1;
+	dict_move(&view->attrs, &aaa->attrs);
+
+	aaa->mp_attrs = mp;
+	dict_init(&aaa->attrs, mm_pool(aaa->mp_attrs));
+	dlist_init(&aaa->values);
+	aaa->attrs_it = NULL;
+
+	debug1("%s() aaa: %p view: %p", __func__, aaa, view);
+	return view;
+}
+
+struct aaa_view *
+aaa_view_ref(struct aaa_view *view)
+{
+	atomic_inc(&view->refs);
+	return view;
+}
+
+void
+aaa_view_unref(struct aaa_view *view)
+{
+	if (atomic_dec(&view->refs))
+		return;
+
+	debug1("%s() view: %p", __func__, view);
+	mm_pool_flush(view->mp);
+	mem_slab_free(view_slab_get(), view);
+}
+
+const char *
+aaa_view_get(struct aaa_view *view, const char *key)
+{
+	if (!key)
+		return NULL;
+
+	struct attr *a = attr_lookup(&view->attrs, key, strlen(key), 0);
+	return a ? a->val: NULL;
+}
+
+int
+aaa_view_walk(struct aaa_view *view, aaa_view_fn_t fn, void *ctx)
+{
+	struct dlist *list = &view->attrs.list;
+	int rv;
+
+	for (struct node *n = dlist_first(list); n; n = dlist_next(list, n)) {
+		struct attr *attr = __container_of(n, struct attr, node);
+		if (!attr->key || !attr->val)
+			continue;
+		if ((rv = fn(ctx, attr->key, attr->val)))
+			return rv;
+	}
+
+	return 0;
+}
+
 int
 aaa_select(struct aaa *aaa, const char *path)
 {
@@ -184,6 +405,20 @@ aaa_touch(struct aaa *aaa)
 	return 0;
 }
 
+int
+aaa_exec(struct aaa *aaa, const char *ops)
+{
+	const char *sid = aaa_attr_get(aaa, "sess.id");
+	debug1("%s(sid: <%s>, ops: %s) aaa: %p", __func__, sid, ops, aaa);
+	if (!sid || !*sid || !ops)
+		return -EINVAL;
+
+	aaa->sid = sid;
+	if (strstr(ops, "commit"))
+		dict_sort(&aaa->attrs);
+	return udp_exec(aaa, ops);
+}
+
 int
 aaa_commit(struct aaa *aaa)
 {
@@ -0,0 +1,463 @@
+#include <sys/compiler.h>
+#include <sys/log.h>
+#include <list.h>
+#include <mem/alloc.h>
+#include <mem/pool.h>
+#include <dict.h>
+#include <hash.h>
+
+#include <aaa/lib.h>
+#include <aaa/prv.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef CONFIG_WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#define poll WSAPoll
+#endif
+
+/*
+ * Pipelined requests share one connected UDP socket per queue. Every request
+ * gets a queue wide msg.id, the server echoes it back so replies are matched
+ * by id in any order. Pending requests are hashed by id, ids are sequential
+ * so the low bits alone spread them evenly over the slots.
+ *
+ * At most OPENAAA_WINDOW requests are on the wire at once, the others wait
+ * in the backlog and are sent as the replies arrive. Bursts of thousands of
+ * datagrams would otherwise overflow the socket buffers and the requests 
+ * would only recover after the retransmit interval.
+ *
+ * Request structures and their packet buffers are recycled through a free
+ * list, the steady state does not allocate.
+ */
+
+#define AAA_QUEUE_BITS 10
+
+struct aaa_request {
+	struct hnode hnode;
+	struct node node;
+	struct aaa *aaa;
+	aaa_complete_t fn;
+	void *data;
+	unsigned int id;
+	int status;
+	int size;
+	int capacity;
+	int rto;
+	int timeout;
+	timestamp_t retransmit;
+	timestamp_t deadline;
+	byte *packet;
+};
+
+struct aaa_queue {
+	struct mm_pool *mp;
+	int fd;
+	pid_t pid;
+	unsigned int msg_id;
+	unsigned int inflight;
+	unsigned int sent;
+	unsigned int window;
+	timestamp_t timer;
+	struct dlist backlog;
+	struct dlist pending;
+	struct dlist done;
+	struct dlist free;
+	DEFINE_HASHTABLE(requests, AAA_QUEUE_BITS);
+};
+
+static inline struct hlist *
+queue_slot(struct aaa_queue *q, unsigned int id)
+{
+	return &q->requests[id & ((1U << AAA_QUEUE_BITS) - 1)];
+}
+
+struct aaa_queue *
+aaa_queue_new(int flags)
+{
+	aaa_lib_init();
+
+	struct mm_pool *mp = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct aaa_queue *q = mm_pool_zalloc(mp, sizeof(*q));
+
+	q->mp = mp;
+	q->timer = (timestamp_t)~0ULL;
+	q->window = aaad_window;
+	dlist_init(&q->backlog);
+	dlist_init(&q->pending);
+	dlist_init(&q->done);
+	dlist_init(&q->free);
+	hash_init(q->requests);
+
+	if ((q->fd = udp_open()) == -1) {
+		mm_pool_destroy(mp);
+		return NULL;
+	}
+
+	q->pid = getpid();
+	debug1("%s() queue: %p", __func__, q);
+	return q;
+}
+
+static inline void
+request_release(struct aaa_request *r)
+{
+	free(r->packet);
+}
+
+void
+aaa_queue_free(struct aaa_queue *q)
+{
+	debug1("%s() queue: %p", __func__, q);
+	dlist_for_each(q->backlog, r, struct aaa_request, node)
+		request_release(r);
+	dlist_for_each(q->pending, r, struct aaa_request, node)
+		request_release(r);
+	dlist_for_each(q->done, r, struct aaa_request, node)
+		request_release(r);
+	dlist_for_each(q->free, r, struct aaa_request, node)
+		request_release(r);
+
+	if (q->pid == getpid())
+		close(q->fd);
+	mm_pool_destroy(q->mp);
+}
+
+int
+aaa_queue_fd(struct aaa_queue *q)
+{
+	return q->fd;
+}
+
+unsigned int
+aaa_queue_inflight(struct aaa_queue *q)
+{
+	return q->inflight;
+}
+
+int
+aaa_queue_timeout(struct aaa_queue *q)
+{
+	if (!q->sent)
+		return -1;
+
+	timestamp_t now = udp_clock();
+	return q->timer > now ? (int)(q->timer - now): 0;
+}
+
+static struct aaa_request *
+request_get(struct aaa_queue *q)
+{
+	struct node *node = dlist_head(&q->free);
+	if (node) {
+		dlist_del(node);
+		return __container_of(node, struct aaa_request, node);
+	}
+
+	struct aaa_request *r = mm_pool_zalloc(q->mp, sizeof(*r));
+	return r;
+}
+
+static inline void
+request_put(struct aaa_queue *q, struct aaa_request *r)
+{
+	dlist_add_head(&q->free, &r->node);
+}
+
+static int
+request_send(struct aaa_queue *q, struct aaa_request *r)
+{
+	int sent = send(q->fd, r->packet, r->size, 0);
+	if (sent == r->size) {
+		debug3("%s:%d sent %d byte(s) id=%u", aaad_ip, aaad_port, sent,
+		       r->id);
+		return 0;
+	}
+
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	if (sent < 0)
+		error("send failed: reason=%s ", strerror(errno));
+	else
+		error("send sent partial packet (%d of %d bytes)", sent, r->size);
+	return -1;
+}
+
+static void
+request_complete(struct aaa_queue *q, struct aaa_request *r, int status)
+{
+	hlist_del(&r->hnode);
+	dlist_del(&r->node);
+	q->inflight--;
+	q->sent--;
+
+	r->status = status;
+	if (!r->fn) {
+		dlist_add_tail(&q->done, &r->node);
+		return;
+	}
+
+	aaa_complete_t fn = r->fn;
+	struct aaa *aaa = r->aaa;
+	void *data = r->data;
+
+	request_put(q, r);
+	fn(aaa, status, data);
+}
+
+/*
+ * The timeout counts from the moment the request leaves the backlog. Send 
+ * errors are not fatal, the request is retransmitted until it expires.
+ */
+
+static void
+request_start(struct aaa_queue *q, struct aaa_request *r, timestamp_t now)
+{
+	r->retransmit = now + r->rto;
+	r->deadline = now + r->timeout;
+
+	hnode_init(&r->hnode);
+	hlist_add(queue_slot(q, r->id), &r->hnode);
+	dlist_add_tail(&q->pending, &r->node);
+	q->timer = __min(q->timer, r->retransmit);
+	q->sent++;
+
+	request_send(q, r);
+}
+
+static void
+queue_flush(struct aaa_queue *q)
+{
+	struct node *node;
+	if (q->sent >= q->window || !(node = dlist_head(&q->backlog)))
+		return;
+
+	timestamp_t now = udp_clock();
+	do {
+		dlist_del(node);
+		request_start(q, __container_of(node, struct aaa_request, node), now);
+	} while (q->sent < q->window && (node = dlist_head(&q->backlog)));
+}
+
+static int
+request_submit(struct aaa_queue *q, struct aaa *aaa, char *op,
+               aaa_complete_t fn, void *data)
+{
+	byte packet[8192];
+
+	const char *sid = aaa_attr_get(aaa, "sess.id");
+	debug2("%s(sid: <%s>) aaa: %p op: %s", __func__, sid, aaa, op);
+	if (!sid || !*sid)
+		return -EINVAL;
+
+	if (q->pid != getpid()) {
+		error("queue used across fork()");
+		return -EINVAL;
+	}
+
+	aaa->sid = sid;
+	unsigned int id = ++q->msg_id;
+	if (!id)
+		id = ++q->msg_id;
+
+	int size = udp_request_build(aaa, op, id, packet, sizeof(packet) - 1);
+	if (size < 1) {
+		error("request op=%s build failed", op);
+		return -EINVAL;
+	}
+	if (size >= aaa_packet_max) {
+		error("packet_size overflow max: %d", aaa_packet_max);
+		return -EINVAL;
+	}
+
+	struct aaa_request *r = request_get(q);
+	if (r->capacity < size) {
+		free(r->packet);
+		r->capacity = __max(size, 512);
+		r->packet = malloc(r->capacity);
+	}
+
+	memcpy(r->packet, packet, size);
+	r->size = size;
+	r->aaa = aaa;
+	r->fn = fn;
+	r->data = data;
+	r->id = id;
+	r->status = 0;
+	r->rto = aaa->retransmit_ms;
+	r->timeout = aaa->timeout_ms;
+
+	dlist_add_tail(&q->backlog, &r->node);
+	q->inflight++;
+	queue_flush(q);
+	return 0;
+}
+
+int
+aaa_bind_async(struct aaa_queue *q, struct aaa *aaa, aaa_complete_t fn,
+               void *data)
+{
+	return request_submit(q, aaa, "bind", fn, data);
+}
+
+int
+aaa_touch_async(struct aaa_queue *q, struct aaa *aaa, aaa_complete_t fn,
+                void *data)
+{
+	return request_submit(q, aaa, "touch", fn, data);
+}
+
+int
+aaa_commit_async(struct aaa_queue *q, struct aaa *aaa, aaa_complete_t fn,
+                 void *data)
+{
+	dict_sort(&aaa->attrs);
+	return request_submit(q, aaa, "commit", fn, data);
+}
+
+int
+aaa_exec_async(struct aaa_queue *q, struct aaa *aaa, const char *ops,
+               aaa_complete_t fn, void *data)
+{
+	if (!ops)
+		return -EINVAL;
+	if (strstr(ops, "commit"))
+		dict_sort(&aaa->attrs);
+	return request_submit(q, aaa, (char *)ops, fn, data);
+}
+
+static struct aaa_request *
+request_lookup(struct aaa_queue *q, unsigned int id)
+{
+	hlist_for_each(queue_slot(q, id), it) {
+		struct aaa_request *r;
+		r = __container_of(it, struct aaa_request, hnode);
+		if (r->id == id)
+			return r;
+	}
+	return NULL;
+}
+
+static int
+queue_recv(struct aaa_queue *q)
+{
+	byte packet[8192];
+	ssize_t recved;
+	int count = 0;
+
+	while ((recved = recv(q->fd, packet, sizeof(packet) - 1, 0)) > 0) {
+		debug3("%s:%d recv %jd byte(s)", aaad_ip, aaad_port,
+		       (intmax_t)recved);
+		if (udp_validate(packet, (int)recved))
+			continue;
+
+		packet[recved] = 0;
+		unsigned int id = udp_reply_id(packet, recved);
+		struct aaa_request *r = request_lookup(q, id);
+		if (!r) {
+			debug2("dropped stale reply id=%u", id);
+			continue;
+		}
+
+		int status = udp_reply_parse(r->aaa, packet, recved);
+		request_complete(q, r, status ? -EINVAL: 0);
+		count++;
+	}
+
+	if (recved < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+	    errno != EINTR && errno != ECONNREFUSED)
+		error("recv failed: reason=%s ", strerror(errno));
+
+	return count;
+}
+
+/*
+ * Retransmits and expires the pending requests. The earliest retransmit time
+ * is cached so the pending list is only walked when some request is due.
+ */
+
+static int
+queue_timers(struct aaa_queue *q, timestamp_t now)
+{
+	if (now < q->timer)
+		return 0;
+
+	int count = 0;
+	q->timer = (timestamp_t)~0ULL;
+
+	dlist_for_each_delsafe(q->pending, r, struct aaa_request, node) {
+		if (now >= r->deadline) {
+			error("request id=%u timed out", r->id);
+			request_complete(q, r, -ETIMEDOUT);
+			count++;
+			continue;
+		}
+
+		if (now >= r->retransmit) {
+			request_send(q, r);
+			r->rto *= 2;
+			r->retransmit = __min(now + r->rto, r->deadline);
+		}
+
+		q->timer = __min(q->timer, r->retransmit);
+	}
+
+	return count;
+}
+
+int
+aaa_poll(struct aaa_queue *q, int timeout)
+{
+	timestamp_t now = udp_clock();
+	timestamp_t deadline = now + (timeout > 0 ? timeout: 0);
+
+	for (;;) {
+		int count = queue_recv(q);
+		count += queue_timers(q, now);
+		queue_flush(q);
+		if (count || !timeout || !q->sent)
+			return count;
+		if (timeout > 0 && now >= deadline)
+			return 0;
+
+		int wait = aaa_queue_timeout(q);
+		if (timeout > 0 && (int)(deadline - now) < wait)
+			wait = (int)(deadline - now);
+
+		struct pollfd pfd = { .fd = q->fd, .events = POLLIN };
+		if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+			error("poll failed: reason=%s ", strerror(errno));
+			return -1;
+		}
+
+		now = udp_clock();
+	}
+}
+
+int
+aaa_queue_next(struct aaa_queue *q, struct aaa **aaa, int *status, void **data)
+{
+	struct node *node = dlist_head(&q->done);
+	if (!node)
+		return 0;
+
+	struct aaa_request *r = __container_of(node, struct aaa_request, node);
+	dlist_del(node);
+
+	if (aaa)
+		*aaa = r->aaa;
+	if (status)
+		*status = r->status;
+	if (data)
+		*data = r->data;
+
+	request_put(q, r);
+	return 1;
+}
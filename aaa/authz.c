@@ -0,0 +1,207 @@
+#include <sys/compiler.h>
+#include <sys/cpu.h>
+#include <sys/log.h>
+#include <list.h>
+#include <mem/pool.h>
+#include <hash.h>
+#include <dict.h>
+
+#include <aaa/lib.h>
+#include <aaa/prv.h>
+#include <aaa/wire.h>
+#include <aaa/authz.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define SLOT_MASK (AAA_AUTHZ_SLOTS - 1)
+
+static inline u32
+role_slot(const char *role, unsigned int len)
+{
+	return (u32)hash_buffer(role, len) & SLOT_MASK;
+}
+
+static int
+role_find(struct aaa_authz_group *group, const char *role, unsigned int len)
+{
+	for (u32 i = role_slot(role, len); group->slot[i]; i = (i + 1) & SLOT_MASK) {
+		const char *it = group->role[group->slot[i] - 1];
+		if (!strncmp(it, role, len) && !it[len])
+			return group->slot[i] - 1;
+	}
+	return -1;
+}
+
+static int
+role_add(struct aaa_authz *authz, struct aaa_authz_group *group, 
+         const char *role, unsigned int len)
+{
+	int index = role_find(group, role, len);
+	if (index >= 0)
+		return index;
+	if (group->roles == AAA_AUTHZ_ROLES)
+		return -1;
+
+	char *name = mm_pool_alloc(authz->mp, len + 1);
+	memcpy(name, role, len);
+	name[len] = 0;
+
+	u32 i = role_slot(role, len);
+	while (group->slot[i])
+		i = (i + 1) & SLOT_MASK;
+
+	index = group->roles++;
+	group->role[index] = name;
+	group->slot[i] = index + 1;
+	return index;
+}
+
+static int
+group_add(struct aaa_authz *authz, const char *name, unsigned int len)
+{
+	for (unsigned int i = 0; i < authz->groups; i++)
+		if (!strncmp(authz->group[i].name, name, len) && 
+		    !authz->group[i].name[len])
+			return i;
+
+	char key[72];
+	int klen = snprintf(key, sizeof(key), "acct.%.*s.roles[]", len, name);
+	if (klen > 64)
+		return -1;
+
+	const struct dict_sym *attr = aaa_attr_intern(key, klen, 1);
+	if (!attr)
+		return -1;
+
+	char *copy = mm_pool_alloc(authz->mp, len + 1);
+	memcpy(copy, name, len);
+	copy[len] = 0;
+
+	if (authz->groups == authz->size) {
+		unsigned int size = authz->size ? authz->size * 2: 8;
+		struct aaa_authz_group *group = 
+			mm_pool_alloc(authz->mp, size * sizeof(*group));
+		if (authz->groups)
+			memcpy(group, authz->group, authz->groups * sizeof(*group));
+		authz->group = group;
+		authz->size = size;
+	}
+
+	struct aaa_authz_group *group = &authz->group[authz->groups];
+	memset(group, 0, sizeof(*group));
+	group->attr = attr;
+	group->name = copy;
+	return authz->groups++;
+}
+
+struct aaa_authz *
+aaa_authz_new(void)
+{
+	struct mm_pool *mp = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct aaa_authz *authz = mm_pool_zalloc(mp, sizeof(*authz));
+	authz->mp = mp;
+	return authz;
+}
+
+void
+aaa_authz_free(struct aaa_authz *authz)
+{
+	mm_pool_destroy(authz->mp);
+}
+
+/*
+ * Compiles the rule "group" or "group:role[,role...]", anything after it
+ * but blanks makes the rule malformed rather than being dropped.
+ */
+
+int
+aaa_authz_compile(struct aaa_authz *authz, const char *line,
+                  struct aaa_authz_rule *rule)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	unsigned int len = strcspn(line, ": \t");
+	if (!len)
+		return -EINVAL;
+
+	int group = group_add(authz, line, len);
+	if (group < 0)
+		return -EINVAL;
+
+	rule->group = group;
+	rule->mask = 0;
+	line += len;
+	if (*line != ':')
+		rule->mask = AAA_AUTHZ_MEMBER;
+	else {
+		/* the role list ends at the first blank */
+		for (line++; *line && *line != ' ' && *line != '\t'; ) {
+			unsigned int n = strcspn(line, ", \t");
+			struct aaa_authz_group *g = &authz->group[group];
+			int index = n ? role_add(authz, g, line, n): 0;
+			if (index < 0)
+				return -ENOSPC;
+			if (n)
+				rule->mask |= 1ULL << index;
+			line += n;
+			if (*line == ',')
+				line++;
+		}
+	}
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (*line)
+		return -EINVAL;
+
+	return rule->mask ? 0: -EINVAL;
+}
+
+/*
+ * Evaluates the value of the group attribute, the roles of the session not
+ * named by any rule are ignored.
+ */
+
+u64
+aaa_authz_roles(struct aaa_authz *authz, unsigned int group, const char *vals)
+{
+	if (!vals || !*vals)
+		return 0;
+
+	struct aaa_authz_group *g = &authz->group[group];
+	u64 roles = AAA_AUTHZ_MEMBER;
+	for (const char *p = vals; *p; ) {
+		unsigned int n = strcspn(p, " ");
+		int index = n ? role_find(g, p, n): -1;
+		roles |= index < 0 ? 0: 1ULL << index;
+		p += n;
+		while (*p == ' ')
+			p++;
+	}
+
+	return roles;
+}
+
+static void
+authz_eval(struct aaa_authz *authz, struct dict *attrs, u64 *roles)
+{
+	for (unsigned int i = 0; i < authz->groups; i++) {
+		struct attr *a = dict_lookup_sym(attrs, authz->group[i].attr, 0);
+		roles[i] = aaa_authz_roles(authz, i, a ? a->val: NULL);
+	}
+}
+
+void
+aaa_authz_eval(struct aaa_authz *authz, struct aaa *aaa, u64 *roles)
+{
+	authz_eval(authz, &aaa->attrs, roles);
+}
+
+void
+aaa_authz_eval_view(struct aaa_authz *authz, struct aaa_view *view, u64 *roles)
+{
+	authz_eval(authz, &view->attrs, roles);
+}
@@ -0,0 +1,104 @@
+/*
+ * (AAA) Autentication, Authorisation and Accounting) Library
+ *
+ * The MIT License (MIT)         Copyright (c) 2015 Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __AAA_AUTHZ_H__
+#define __AAA_AUTHZ_H__
+
+#include <sys/compiler.h>
+#include <mem/pool.h>
+#include <dict.h>
+
+/*
+ * Authorization rules compiled at configuration time. A rule is "group" or
+ * "group:role[,role...]" with no other tokens. The group resolves to the 
+ * interned attribute acct.<group>.roles[] and an index into the rule set,
+ * each role to a bit of its group. The set grows with its groups, a group
+ * has at most AAA_AUTHZ_ROLES roles.
+ *
+ * The roles of a session are evaluated once into a bitset per group with
+ * AAA_AUTHZ_MEMBER set when the attribute has a non-empty value, an empty
+ * or missing attribute grants nothing. The caller provides the bitsets for
+ * all the groups of the set. Checking a rule is then one test of its mask 
+ * against the bitset of its group.
+ */
+
+#define AAA_AUTHZ_ROLES  63
+#define AAA_AUTHZ_SLOTS  128
+#define AAA_AUTHZ_MEMBER (1ULL << 63)
+
+struct aaa;
+struct aaa_view;
+
+struct aaa_authz_group {
+	const struct dict_sym *attr;
+	const char *name;
+	unsigned int roles;
+	const char *role[AAA_AUTHZ_ROLES];
+	u8 slot[AAA_AUTHZ_SLOTS];          /* role hash to role index + 1 */
+};
+
+struct aaa_authz {
+	struct mm_pool *mp;
+	unsigned int groups;
+	unsigned int size;
+	struct aaa_authz_group *group;
+};
+
+struct aaa_authz_rule {
+	unsigned int group;
+	u64 mask;
+};
+
+struct aaa_authz *
+aaa_authz_new(void);
+
+void
+aaa_authz_free(struct aaa_authz *authz);
+
+/*
+ * Returns 0, -EINVAL when the rule is malformed or -ENOSPC when its group 
+ * would have more than AAA_AUTHZ_ROLES roles.
+ */
+
+int
+aaa_authz_compile(struct aaa_authz *authz, const char *line,
+                  struct aaa_authz_rule *rule);
+
+u64
+aaa_authz_roles(struct aaa_authz *authz, unsigned int group, const char *vals);
+
+void
+aaa_authz_eval(struct aaa_authz *authz, struct aaa *aaa, u64 *roles);
+
+void
+aaa_authz_eval_view(struct aaa_authz *authz, struct aaa_view *view, u64 *roles);
+
+static inline int
+aaa_authz_check(const struct aaa_authz_rule *rule, const u64 *roles)
+{
+	return (roles[rule->group] & rule->mask) != 0;
+}
+
+#endif
@@ -13,6 +13,15 @@
 
 const char *aaad_ip = "127.0.0.1";
 const char *aaad_host;
+int aaad_port = 8888;
+int aaad_workers = 0;
+int aaad_batch = 32;
+int aaad_timeout = 3000;
+int aaad_retransmit = 100;
+int aaad_window = 128;
+int aaad_wire = 1;
+const char *aaad_store;
+int aaad_checkpoint = 30;
 
 void
 aaa_env_init(void)
@@ -33,6 +42,14 @@ aaa_env_init(void)
 	const char *logf = getenv("OPENAAA_LOG_FILE");
 	const char *logc = getenv("OPENAAA_LOG_CAPS");
 	const char *logv = getenv("OPENAAA_VERBOSE");
+	const char *port = getenv("OPENAAA_SERVICE_PORT");
+	const char *workers = getenv("OPENAAA_WORKERS");
+	const char *batch = getenv("OPENAAA_BATCH");
+	const char *timeout = getenv("OPENAAA_TIMEOUT");
+	const char *retransmit = getenv("OPENAAA_RETRANSMIT");
+	const char *window = getenv("OPENAAA_WINDOW");
+	const char *proto = getenv("OPENAAA_PROTOCOL");
+	const char *checkpoint = getenv("OPENAAA_CHECKPOINT");
 
 	logf = logf ? logf: "syslog";
 	if (logc)
@@ -42,6 +59,27 @@ aaa_env_init(void)
 
 	log_open(logf);
 
+	if (port)
+		aaad_port = atoi(port);
+	if (workers)
+		aaad_workers = atoi(workers);
+	if (batch)
+		aaad_batch = atoi(batch);
+	if (timeout)
+		aaad_timeout = atoi(timeout);
+	if (retransmit)
+		aaad_retransmit = atoi(retransmit);
+	if (window && atoi(window) > 0)
+		aaad_window = atoi(window);
+	if (proto)
+		aaad_wire = strcmp(proto, "text") ? 1: 0;
+	if (checkpoint)
+		aaad_checkpoint = atoi(checkpoint);
+
+	const char *store = getenv("OPENAAA_STORE");
+	if (store && *store)
+		aaad_store = strdup(store);
+
 	if (aaad_host) {
 		debug1("aaa.service.ip=%s", aaad_host);
         	aaad_ip = strdup(aaad_host);
@@ -0,0 +1,100 @@
+/*
+ * (AAA) Autentication, Authorisation and Accounting) Library
+ *
+ * The MIT License (MIT)         Copyright (c) 2015 Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __AAA_HANDLER_H__
+#define __AAA_HANDLER_H__
+
+#include <aaa/lib.h>
+
+/*
+ * Handler modules authorize TLS handshakes in the process of the TLS endpoint.
+ * When OPENAAA_HANDLER names a shared object (*.so) it is loaded once,
+ * otherwise the handler program is executed for every handshake. The exit
+ * status of the program decides as the return value of the module does, a
+ * synchronous server handshake is refused unless the program exits with 0.
+ *
+ * The module exports aaa_handler_authenticate(), called for each handshake
+ * with its channel binding. aaa_handler_init() is called once after loading
+ * and aaa_handler_close() at exit, both are optional.
+ */
+
+#define AAA_HANDLER_INIT         "aaa_handler_init"
+#define AAA_HANDLER_AUTHENTICATE "aaa_handler_authenticate"
+#define AAA_HANDLER_CLOSE        "aaa_handler_close"
+
+struct aaa_handler_args {
+	enum aaa_endpoint endpoint;
+	const char *authority;
+	const char *sess_id;         /* server endpoint only */
+	const char *binding_id;
+	const char *binding_key;
+	const char *group;
+	const char *role;
+};
+
+typedef int  (*aaa_handler_init_t)(void);
+typedef int  (*aaa_handler_authenticate_t)(const struct aaa_handler_args *);
+typedef void (*aaa_handler_close_t)(void);
+
+/*
+ * NAME
+ *
+ * aaa_handler_init()
+ *
+ * DESCRIPTION
+ *
+ * Initializes the handler module after it was loaded.
+ *
+ * RETURN
+ *
+ * Upon successful completion, 0 is returned. Otherwise the module is not used.
+ */
+
+int
+aaa_handler_init(void);
+
+/*
+ * NAME
+ *
+ * aaa_handler_authenticate()
+ *
+ * DESCRIPTION
+ *
+ * Authenticates the handshake identified by its channel binding. It runs in
+ * the handshake of the TLS endpoint and should not block for long.
+ *
+ * RETURN
+ *
+ * When the handshake is authenticated, 0 is returned. Otherwise a non-zero
+ * value is returned and a synchronous server handshake is refused.
+ */
+
+int
+aaa_handler_authenticate(const struct aaa_handler_args *args);
+
+void
+aaa_handler_close(void);
+
+#endif
@@ -42,6 +42,13 @@ enum aaa_endpoint {
 	AAA_ENDPOINT_SERVER = 2
 };
 
+enum aaa_opt_e {
+	AAA_OPT_USERDATA   = 1,
+	AAA_OPT_CUSTOMLOG  = 2,
+	AAA_OPT_TIMEOUT    = 3,
+	AAA_OPT_RETRANSMIT = 4
+};
+
 /* public api functions */
 
 /*
@@ -83,6 +90,28 @@ aaa_free(struct aaa *);
 void
 aaa_set_timeout(struct aaa *, int timeout);
 
+/*
+ * NAME
+ *
+ * aaa_set_opt()
+ *
+ * DESCRIPTION
+ *
+ * Sets the numeric option @opt of the context. 
+ *
+ * AAA_OPT_TIMEOUT     overall request timeout in milliseconds
+ * AAA_OPT_RETRANSMIT  initial retransmit interval in milliseconds, doubles
+ *                     with every retransmission
+ *
+ * RETURN
+ *
+ * Upon successful completion, 0 is returned.  Otherwise, a negative
+ * error code is returned.
+ */
+
+int
+aaa_set_opt(struct aaa *, enum aaa_opt_e opt, int value);
+
 /*
  * NAME
  *
@@ -129,6 +158,8 @@ aaa_reset(struct aaa *aaa);
  * rules. It must be performed on a context which is bound
  * and the context must be destroyed afterwards.
  *
+ * Names ending in '+' or '-' are reserved for the value set operations.
+ *
  * RETURN
  *
  * Upon successful completion, 0 is returned.  Otherwise, a negative
@@ -160,16 +191,38 @@ aaa_attr_get(struct aaa *, const char *attr);
 /*
  * NAME
  *
- * aaa_object_set()
+ * aaa_attr_add_value()
  *
  * DESCRIPTION
  *
- * Sets the binary object
- *                                                                              
+ * Adds @val to the set of values of the multi-valued attribute identified
+ * by @key. The values are kept sorted and unique, separated by spaces, and
+ * must not contain spaces. On commit the server adds @val to the stored set,
+ * values added by others in the meantime are kept.
+ *
+ * RETURN
+ *
+ * Upon successful completion, 0 is returned.  Otherwise, a negative
+ * error code is returned.
+ */
+
+int
+aaa_attr_add_value(struct aaa *, const char *key, const char *val);
+
+/*
+ * NAME
+ *
+ * aaa_attr_del_value()
+ *
+ * DESCRIPTION
+ *
+ * Removes @val from the set of values of the multi-valued attribute 
+ * identified by @key, see aaa_attr_add_value().
+ *
  * RETURN
  *
- * Upon successful completion, 0 is returned.  Otherwise, a negative            
- * error code is returned.                                                      
+ * Upon successful completion, 0 is returned.  Otherwise, a negative
+ * error code is returned.
  */
 
 int
@@ -271,6 +324,75 @@ aaa_attr_next(struct aaa *);
 void
 aaa_attr_dump(struct aaa *aaa, const char *path);
 
+/* A private structure containing a read-only view of the attributes */
+struct aaa_view;
+
+typedef int (*aaa_view_fn_t)(void *ctx, const char *key, const char *val);
+
+/*
+ * NAME
+ *
+ * aaa_view()
+ *
+ * DESCRIPTION
+ *
+ * Moves the attributes of the context into a new read-only view without 
+ * copying them, the context is left empty as after aaa_reset(). The view 
+ * is not bound to the context, it can be read from any thread while the 
+ * context is reused.
+ *
+ * The view holds one reference which is released by aaa_view_unref(), 
+ * further references are taken by aaa_view_ref().
+ *
+ * RETURN
+ *
+ * A pointer to the new view is returned.
+ */
+
+struct aaa_view *
+aaa_view(struct aaa *);
+
+struct aaa_view *
+aaa_view_ref(struct aaa_view *);
+
+void
+aaa_view_unref(struct aaa_view *);
+
+/*
+ * NAME
+ *
+ * aaa_view_get()
+ *
+ * DESCRIPTION
+ *
+ * Gets the value of the attribute identified by @key from the view.
+ *
+ * RETURN
+ *
+ * The value of the attribute or NULL is returned.
+ */
+
+const char *
+aaa_view_get(struct aaa_view *, const char *key);
+
+/*
+ * NAME
+ *
+ * aaa_view_walk()
+ *
+ * DESCRIPTION
+ *
+ * Calls @fn for every attribute of the view in the order of the context.
+ * The walk stops when @fn returns a non-zero value.
+ *
+ * RETURN
+ *
+ * Zero or the value returned by @fn is returned.
+ */
+
+int
+aaa_view_walk(struct aaa_view *, aaa_view_fn_t fn, void *ctx);
+
 /*
  * NAME
  *
@@ -313,11 +435,171 @@ aaa_touch(struct aaa *);
 int
 aaa_commit(struct aaa *);
 
-enum aaa_opt_e {                                                                
-	AAA_OPT_USERDATA  = 1,                                                  
-	AAA_OPT_CUSTOMLOG = 2                                                   
-};
+/*
+ * NAME
+ *
+ * aaa_exec()
+ *
+ * DESCRIPTION
+ *
+ * Executes the ';' separated list of operations @ops (bind, touch, select,
+ * commit, list) on the session in one round trip, e.g. "bind;touch;commit".
+ * The operations are executed in order, none of them is interleaved with 
+ * other requests for the same session and the first failure stops the list.
+ * The attributes of the reply are stored in the context. 
+ *
+ * Unlike aaa_touch(), the touch operation extends the session on the server
+ * unless sess.expires was set by the client.
+ *
+ * The select operation reads the session without creating it, a session 
+ * unknown by sess.id is found by its binding key sess.key. The list 
+ * operation returns the sessions of user.id in user.session.0, 
+ * user.session.1, ... and their count in user.sessions.
+ *
+ * RETURN
+ *
+ * Upon successful completion, 0 is returned.  Otherwise, a negative
+ * error code is returned.
+ */
+
+int
+aaa_exec(struct aaa *, const char *ops);
 
 typedef void (*aaa_custom_log_t)(struct aaa*, unsigned level, const char *msg);
 
+/* A private structure containing the queue of pipelined requests */
+struct aaa_queue;
+
+typedef void (*aaa_complete_t)(struct aaa *, int status, void *data);
+
+/*
+ * NAME
+ *
+ * aaa_queue_new()
+ *
+ * DESCRIPTION
+ *
+ * Creates a new queue for asynchronous requests. The queue owns one connected
+ * non-blocking socket, see aaa_queue_fd(). A queue must not be shared between
+ * threads or used across fork().
+ *
+ * RETURN
+ *
+ * A pointer to the new queue or NULL is returned.
+ */
+
+struct aaa_queue *
+aaa_queue_new(int flags);
+
+void
+aaa_queue_free(struct aaa_queue *);
+
+/*
+ * NAME
+ *
+ * aaa_queue_fd()
+ *
+ * DESCRIPTION
+ *
+ * Returns the descriptor which becomes readable when replies arrive. It can
+ * be registered with an external event loop together with the timer returned
+ * by aaa_queue_timeout(). aaa_poll() with zero timeout is called when either
+ * of them fires.
+ */
+
+int
+aaa_queue_fd(struct aaa_queue *);
+
+/*
+ * NAME
+ *
+ * aaa_queue_timeout()
+ *
+ * RETURN
+ *
+ * The number of milliseconds until the next retransmission or expiration is
+ * due, or -1 when no request is in flight.
+ */
+
+int
+aaa_queue_timeout(struct aaa_queue *);
+
+unsigned int
+aaa_queue_inflight(struct aaa_queue *);
+
+/*
+ * NAME
+ *
+ * aaa_bind_async(), aaa_touch_async(), aaa_commit_async(), aaa_exec_async()
+ *
+ * DESCRIPTION
+ *
+ * Submits the operation for the session identified by the sess.id attribute
+ * of @aaa and returns immediately. The reply is matched by msg.id, requests
+ * complete in any order.
+ *
+ * On completion the attributes of the reply are stored in @aaa and @fn is
+ * called with the status of the operation and @data. When @fn is NULL the 
+ * completion is queued and can be fetched with aaa_queue_next().
+ *
+ * The context must stay valid and must not have another request in flight 
+ * until the request completes. The status is 0 on success, -ETIMEDOUT when 
+ * no reply arrived within AAA_OPT_TIMEOUT or another negative error code.
+ *
+ * RETURN
+ *
+ * Upon successful submission, 0 is returned.  Otherwise, a negative
+ * error code is returned and the callback is never called.
+ */
+
+int
+aaa_bind_async(struct aaa_queue *, struct aaa *, aaa_complete_t fn, void *data);
+
+int
+aaa_touch_async(struct aaa_queue *, struct aaa *, aaa_complete_t fn, void *data);
+
+int
+aaa_commit_async(struct aaa_queue *, struct aaa *, aaa_complete_t fn, void *data);
+
+int
+aaa_exec_async(struct aaa_queue *, struct aaa *, const char *ops,
+               aaa_complete_t fn, void *data);
+
+/*
+ * NAME
+ *
+ * aaa_poll()
+ *
+ * DESCRIPTION
+ *
+ * Receives the replies, retransmits and expires the requests in flight and
+ * delivers their completions. It waits up to @timeout milliseconds for at 
+ * least one completion, zero does not block and a negative @timeout waits 
+ * until some request completes.
+ *
+ * RETURN
+ *
+ * The number of completed requests, or -1 on error.
+ */
+
+int
+aaa_poll(struct aaa_queue *, int timeout);
+
+/*
+ * NAME
+ *
+ * aaa_queue_next()
+ *
+ * DESCRIPTION
+ *
+ * Pops the next completion of a request submitted without the callback.
+ *
+ * RETURN
+ *
+ * 1 when a completion was returned, 0 when the completion queue is empty.
+ */
+
+int
+aaa_queue_next(struct aaa_queue *, struct aaa **aaa, int *status, void **data);
+
 #endif/*__AAA_LIB_H__*/
@@ -4,12 +4,14 @@
 #include <mem/alloc.h>
 #include <mem/stack.h>
 #include <mem/pool.h>
+#include <mem/unaligned.h>
 #include <list.h>
 #include <dict.h>
 #include <hash.h>
 
 #include <aaa/lib.h>
 #include <aaa/prv.h>
+#include <aaa/wire.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,17 +23,17 @@
 #include <sys/types.h>
 
 #ifndef CONFIG_WIN32
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>                                                         
 #include <netinet/in.h>                                                         
 #include <arpa/inet.h>
 #else
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#define poll WSAPoll
 #endif
 
-static int port = 8888;
-static int sched_workers = 4;
-
 static int
 attr_enc(byte *buf, int len, int maxlen, char *key, char *val)
 {
@@ -79,8 +81,8 @@ static inline int
 validate_key(char *key)
 {
 	size_t len = strlen(key);
-	if (len < 5)
-		return -1;
+	if (len < 5 || aaa_value_op_key(key, len))
+		goto invalid;
 	if (!strncmp(key, "sess.", 5))
 		return 0;
 	if (!strncmp(key, "user.", 5))
@@ -91,37 +93,123 @@ validate_key(char *key)
 		return 0;
 	if (!strncmp(key, "msg.", 4))
 		return 0;
-
+invalid:
 	error("invalid attr name: %s", key);
 	return -1;
 }
 
 static int
-udp_build(struct aaa *aaa, char *op, byte *buf, int size)
+wire_build(struct aaa *aaa, char *op, unsigned int id, byte *buf, int size)
+{
+	struct aaa_wire_hdr hdr = {
+		.id = id, .hash = aaa_steer_hash(aaa->sid)
+	};
+
+	int nops = aaa_wire_ops(hdr.ops, op);
+	if (nops < 1)
+		return -1;
+
+	hdr.op = hdr.ops[0];
+	hdr.nops = nops;
+
+	int len = aaa_wire_hdr(buf, size, &hdr);
+	len = aaa_wire_put(buf, len, size, "sess.id", aaa->sid);
+
+	dict_for_each(a, aaa->attrs.list) {
+		if ((a->flags & (ATTR_CHANGED | ATTR_VALUES)) != ATTR_CHANGED)
+			continue;
+		if (aaa_attr_id(a) == AAA_ATTR_SESS_ID)
+			continue;
+		if ((len = aaa_wire_put(buf, len, size, a->key, a->val)) < 0)
+			return -1;
+	}
+
+	struct aaa_value_op *v;
+	dlist_walk(aaa->values, v, node) {
+		if (!(v->attr->flags & ATTR_VALUES))
+			continue;
+		len = aaa_wire_put_value(buf, len, size, v->attr->key, v->val, v->del);
+		if (len < 0)
+			return -1;
+	}
+
+	return len;
+}
+
+static int
+wire_attr(void *ctx, unsigned int id, const char *key, const char *val,
+          unsigned int len)
 {
+	struct aaa *aaa = (struct aaa *)ctx;
+	if (id == AAA_ATTR_SESS_ID && (len < 8 || len > 64)) {
+		error("invalid sess_id attribute");
+		return -1;
+	}
+
+	struct attr *a = aaa_attr_lookup(aaa, key, strlen(key), AAA_ATTR_RECV);
+	a->val = mm_strdup(aaa->attrs.mm, val);
+	return 0;
+}
+
+/*
+ * sess.id always goes first, the server steers text datagrams to workers by
+ * the value of the first line, binary ones by the hash in the header.
+ */
+
+int
+udp_request_build(struct aaa *aaa, char *op, unsigned int id, byte *buf, int size)
+{
+	if (aaad_wire)
+		return wire_build(aaa, op, id, buf, size);
+
+	u8 ops[AAA_WIRE_OPS];
+	if (aaa_wire_ops(ops, op) < 1)
+		return -1;
+
 	int len = 0, rv = 0;
+	len += attr_enc(buf, len, size, "sess.id", (char *)aaa->sid);
 	len += attr_enc(buf, len, size, "msg.op", op);
-	len += attr_enc(buf, len, size, "msg.id", "1");
+	len += attr_enc(buf, len, size, "msg.id", printfa("%u", id));
 
 	dict_for_each(a, aaa->attrs.list) {
 		debug4("udp build %s:%s %s ", a->key, a->val, 
 		       a->flags & ATTR_CHANGED ? "changed" : ""); 
-		if (validate_key(a->key))
+		if (!a->id && validate_key(a->key))
 			return -1;
-                if (!(a->flags & ATTR_CHANGED))
+                if ((a->flags & (ATTR_CHANGED | ATTR_VALUES)) != ATTR_CHANGED)
                         continue;
+		if (aaa_attr_id(a) == AAA_ATTR_SESS_ID)
+			continue;
 		if ((rv = attr_enc(buf, len, size, a->key, a->val)) < 5)
 			return -1;
 		len += rv;
 	}
 
+	struct aaa_value_op *v;
+	dlist_walk(aaa->values, v, node) {
+		if (!(v->attr->flags & ATTR_VALUES))
+			continue;
+		char *key = printfa("%s%c", v->attr->key, v->del ? '-': '+');
+		if ((rv = attr_enc(buf, len, size, key, (char *)v->val)) < 5)
+			return -1;
+		len += rv;
+	}
+
 	return len;
 }
 
-static int 
-udp_parse(struct aaa *aaa, byte *packet, unsigned int len)
+int 
+udp_reply_parse(struct aaa *aaa, byte *packet, unsigned int len)
 {
+	if (aaa_wire_is(packet, len)) {
+		struct aaa_wire_hdr hdr;
+		if (aaa_wire_parse(packet, len, &hdr, wire_attr, aaa))
+			return -1;
+		return hdr.status ? -1: 0;
+	}
+
 	char *sid = NULL;
+	int status = 0;
 	byte *end = packet + len;
 	while (packet < end) {
 		byte *key = packet;
@@ -139,6 +227,8 @@ udp_parse(struct aaa *aaa, byte *packet, unsigned int len)
 			return -1;
 		*packet++ = 0;
 
+		if (!strcmp(key, "msg.status"))
+			status = atoi(value);
 		if (!strncmp(key, "msg.", 4))
 			continue;
 		if (!strncmp(key, "sess.id", 7))
@@ -146,7 +236,9 @@ udp_parse(struct aaa *aaa, byte *packet, unsigned int len)
 		if (*key == '.')
 			return -1;
 
-		dict_set_nf(&aaa->attrs, key, value);
+		struct attr *a = aaa_attr_lookup(aaa, key, value - key - 1, 
+		                                 AAA_ATTR_RECV);
+		a->val = mm_strdup(aaa->attrs.mm, value);
 	}
 
 	size_t sess_id_len = sid ? strlen(sid): 0;
@@ -155,144 +247,190 @@ udp_parse(struct aaa *aaa, byte *packet, unsigned int len)
 		return -1;
 	}
 
-	return 0;
+	return status ? -1: 0;
 }
 
-int
-udp_bind(struct aaa *aaa)
+unsigned int
+udp_reply_id(byte *packet, unsigned int len)
 {
-        int fd = -1, rc = -1;
-        byte packet[8192];
-        memset(packet, 0, sizeof(packet));
+	if (aaa_wire_is(packet, len))
+		return get_u32_be(packet + 4);
+
+	byte *end = packet + len;
+	for (byte *p = packet; p < end; ) {
+		if (end - p > 7 && !memcmp(p, "msg.id:", 7))
+			return strtoul((char *)p + 7, NULL, 10);
+		while (p < end && *p++ != '\n');
+	}
 
-        int size = udp_build(aaa, "bind", packet, sizeof(packet) - 1);
-	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
-		die("Cannot create UDP socket: %s", strerror(errno));
+	return 0;
+}
 
-	int one = 1;
-	if (setsockopt(fd , SOL_SOCKET, SO_REUSEADDR, (const void *)&one, sizeof(one)) < 0)
-		die("Cannot set SO_REUSEADDR: %s", strerror(errno));
+/*
+ * Every context keeps one connected non-blocking UDP socket. It is created 
+ * lazily on the first request and recreated after fork() so children never 
+ * share a socket with their parent.
+ */
 
-	struct timeval tv = {.tv_sec = 10, .tv_usec = 0 };
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const void *)&tv,sizeof(tv)) < 0)
-		die("SO_RCVTIMEO");
+int
+udp_open(void)
+{
+	int fd;
+	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+		error("Cannot create UDP socket: %s", strerror(errno));
+		return -1;
+	}
 
-	u32 hash = hash_string(aaa->sid);
-	int index = hash % sched_workers;
-	debug4("udp commit id=%s index=%d", aaa->sid, index);
+#ifndef CONFIG_WIN32
+	int flags = fcntl(fd, F_GETFL, 0);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#else
+	u_long one = 1;
+	ioctlsocket(fd, FIONBIO, &one);
+#endif
 
 	struct sockaddr_in in = {
 		.sin_family = AF_INET,
-		.sin_port = htons(port + index),
+		.sin_port = htons(aaad_port),
 		.sin_addr.s_addr = inet_addr(aaad_ip)
 	};
 
-	socklen_t len = sizeof(in);
-	if (len >= aaa_packet_max) {
-		error("packet_size overflow max: %d", aaa_packet_max);
-		goto cleanup;
+	if (connect(fd, (struct sockaddr *)&in, sizeof(in)) < 0) {
+		error("Cannot connect UDP socket: %s", strerror(errno));
+		close(fd);
+		return -1;
 	}
 
-        int sent = sendto(fd, packet, size, 0, (struct sockaddr * )&in, len);
-	if (sent < 0)
-	        error("sendto failed: reason=%s ", strerror(errno));
-	else if (sent < size)
-		error("sendto sent partial packet (%d of %d bytes)", sent, (int)size);
+	debug2("%s:%d connected", aaad_ip, aaad_port);
+	return fd;
+}
 
-        char *v = printfa("%s:%d", inet_ntoa(in.sin_addr), ntohs(in.sin_port));
-        debug2("%s sent %d byte(s)", v, sent);
+static int
+udp_connect(struct aaa *aaa)
+{
+	if (aaa->fd != -1 && aaa->pid == getpid())
+		return 0;
 
-        memset(packet, 0, sizeof(packet));
-	ssize_t recved = recvfrom(fd, packet, sizeof(packet) - 1, MSG_TRUNC, 
-                                  (struct sockaddr *)&in, &len);
-	if (recved < 0) {
-	        error("recvfrom failed: reason=%s ", strerror(errno));
-                goto cleanup;
-        }
+	udp_close(aaa);
+	if ((aaa->fd = udp_open()) == -1)
+		return -1;
 
-        debug2("%s recv %jd byte(s)", v, (intmax_t)recved);
+	aaa->pid = getpid();
+	return 0;
+}
 
-	if (udp_validate(packet, (int)recved))
-		goto cleanup;
+void
+udp_close(struct aaa *aaa)
+{
+	if (aaa->fd != -1 && aaa->pid == getpid())
+		close(aaa->fd);
+	aaa->fd = -1;
+}
 
-	if (size >= aaa_packet_max) {
-		error("packet_size overflow max: %d", aaa_packet_max);
-		goto cleanup;
-	}
+timestamp_t
+udp_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (timestamp_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-        if (!udp_parse(aaa, packet, (unsigned int)recved))
-		rc = 0;
+/*
+ * Sends the request and waits for the reply with the matching msg.id. The
+ * request is retransmitted when no reply arrives within the retransmit 
+ * interval, the interval doubles with every attempt until the overall 
+ * timeout expires. Late replies to earlier requests are dropped.
+ */
 
-cleanup:        
-        if (fd != -1)
-                close(fd);
+static int
+udp_request(struct aaa *aaa, char *op)
+{
+	byte request[8192], packet[8192];
+	unsigned int id = ++aaa->msg_id, rid;
 
-        return rc;
-}
+	int size = udp_request_build(aaa, op, id, request, sizeof(request) - 1);
+	if (size < 1) {
+		error("request op=%s build failed", op);
+		return -EINVAL;
+	}
+	if (size >= aaa_packet_max) {
+		error("packet_size overflow max: %d", aaa_packet_max);
+		return -1;
+	}
 
-int
-udp_commit(struct aaa *aaa)
-{
-        int fd = -1;
-        byte packet[8192];
-        memset(packet, 0, sizeof(packet));
+	if (udp_connect(aaa))
+		return -1;
 
-        int size = udp_build(aaa, "commit", packet, sizeof(packet) - 1);
-	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
-		die("Cannot create UDP socket: %s", strerror(errno));
+	timestamp_t now = udp_clock();
+	timestamp_t deadline = now + aaa->timeout_ms;
+	timestamp_t retransmit = now;
+	int rto = aaa->retransmit_ms;
+
+	do {
+		if (now >= retransmit) {
+			int sent = send(aaa->fd, request, size, 0);
+			if (sent < 0)
+				error("send failed: reason=%s ", strerror(errno));
+			else if (sent < size)
+				error("send sent partial packet (%d of %d bytes)", 
+				      sent, (int)size);
+			else
+				debug2("%s:%d sent %d byte(s) id=%u", 
+				       aaad_ip, aaad_port, sent, id);
+
+			retransmit = now + rto;
+			rto *= 2;
+		}
+
+		struct pollfd pfd = { .fd = aaa->fd, .events = POLLIN };
+		int wait = (int)(__min(retransmit, deadline) - now);
+		if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+			error("poll failed: reason=%s ", strerror(errno));
+			return -1;
+		}
 
-	int one = 1;
-	if (setsockopt(fd , SOL_SOCKET, SO_REUSEADDR, (const void *)&one, sizeof(one)) < 0)
-		die("Cannot set SO_REUSEADDR: %s", strerror(errno));
+		ssize_t recved;
+		while ((recved = recv(aaa->fd, packet, sizeof(packet) - 1, 0)) > 0) {
+			debug2("%s:%d recv %jd byte(s)", aaad_ip, aaad_port, 
+			       (intmax_t)recved);
+			if (udp_validate(packet, (int)recved))
+				continue;
 
-	struct timeval tv = {.tv_sec = 10, .tv_usec = 0 };
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const void *)&tv,sizeof(tv)) < 0)
-		die("SO_RCVTIMEO");
+			packet[recved] = 0;
+			if ((rid = udp_reply_id(packet, recved)) != id) {
+				debug2("dropped stale reply id=%u expected=%u", rid, id);
+				continue;
+			}
 
-	u32 hash = hash_string(aaa->sid);
-	int index = hash % sched_workers;
-	debug4("udp commit id=%s index=%d", aaa->sid, index);
+			return udp_reply_parse(aaa, packet, (unsigned int)recved);
+		}
 
-	struct sockaddr_in in = {
-		.sin_family = AF_INET,
-		.sin_port = htons(port + index),
-		.sin_addr.s_addr = inet_addr(aaad_ip)
-	};
+		if (recved < 0 && errno != EAGAIN && errno != EWOULDBLOCK && 
+		    errno != EINTR && errno != ECONNREFUSED)
+			error("recv failed: reason=%s ", strerror(errno));
 
-	socklen_t len = sizeof(in);
-	if (len >= aaa_packet_max) {
-		error("packet_size overflow max: %d", aaa_packet_max);
-		goto cleanup;
-	}
+		now = udp_clock();
+	} while (now < deadline);
 
-        int sent = sendto(fd, packet, size, 0, (struct sockaddr *)&in, len);
-	if (sent < 0)
-	        error("sendto failed: reason=%s ", strerror(errno));
-	else if (sent < size)
-		error("sendto sent partial packet (%d of %d bytes)", sent, (int)size);
-
-        char *v = printfa("%s:%d", inet_ntoa(in.sin_addr), ntohs(in.sin_port));
-        debug2("%s sent %d byte(s)", v, sent);
-
-        memset(packet, 0, sizeof(packet));
-	ssize_t recved = recvfrom(fd, packet, sizeof(packet) - 1, MSG_TRUNC, 
-                                  (struct sockaddr *)&in, &len);
-	if (recved < 0) {
-	        error("recvfrom failed: reason=%s ", strerror(errno));
-                goto cleanup;
-        }
-
-        debug2("%s recv %jd byte(s)", v, (intmax_t)recved);
-	if (recved >= aaa_packet_max) {
-		error("packet_size overflow max: %d", aaa_packet_max);
-		goto cleanup;
-	}
+	error("request id=%u op=%s timed out after %d ms", id, op, aaa->timeout_ms);
+	return -1;
+}
 
-        udp_parse(aaa, packet, (unsigned int)recved);
+int
+udp_bind(struct aaa *aaa)
+{
+	return udp_request(aaa, "bind");
+}
 
-cleanup:        
-        if (fd != -1)
-                close(fd);
+int
+udp_commit(struct aaa *aaa)
+{
+	return udp_request(aaa, "commit");
+}
 
-        return 0;
+int
+udp_exec(struct aaa *aaa, const char *ops)
+{
+	return udp_request(aaa, (char *)ops);
 }
@@ -30,22 +30,44 @@
 #include <mem/alloc.h>
 #include <mem/pool.h>
 #include <dict.h>
+#include <aaa/wire.h>
 
 struct aaa {
 	struct mm_pool *mp;
 	struct mm_pool *mp_attrs;
 	struct dict attrs;
         struct node *attrs_it;
+	struct dlist values;       /* value set operations, see aaa_value_op */
 	const char *config;
 	const char *sid;           /* used internally only */
 	const char *uid;
 	unsigned int tid;
 	unsigned int timeout;
+	int fd;                    /* persistent transport */
+	pid_t pid;
+	unsigned int msg_id;
+	int timeout_ms;
+	int retransmit_ms;
+};
+
+/*
+ * A read-only view owns the attribute pool of the context it was taken from,
+ * released views keep their flushed pool to be handed to the next context.
+ */
+
+struct aaa_view {
+	struct mm_pool *mp;
+	struct dict attrs;
+	int refs;
 };
 
 struct msg {
 	struct aaa *aaa;
 	int status;
+	int wire;                  /* binary framing, see wire.h */
+	unsigned int seq;
+	unsigned int nops;
+	u8 ops[AAA_WIRE_OPS];
 	const char *id;
 	const char *op;
 	const char *sid;
@@ -53,12 +75,74 @@ struct msg {
 };
 
 void aaa_config_load(struct aaa *c);
+
+/*
+ * Names received from peers are looked up with AAA_ATTR_RECV, they resolve 
+ * to the names interned already and are copied otherwise. Interning them 
+ * would let any peer fill the process-wide table of names.
+ */
+
+#define AAA_ATTR_RECV 2
+
+struct attr *
+aaa_attr_lookup(struct aaa *aaa, const char *key, unsigned int len, int create);
+
+/*
+ * Values added to or removed from a multi-valued attribute are applied to 
+ * the local value and recorded. An attribute changed only by them is marked 
+ * ATTR_VALUES, the request carries the operations instead of its value and 
+ * the server applies them to the stored one.
+ */
+
+struct aaa_value_op {
+	struct node node;
+	struct attr *attr;
+	const char *val;
+	int del;
+};
+
+int
+aaa_value_op(struct aaa *aaa, struct attr *a, const char *val, int del);
+
+/* 
+ * The text protocol sends the operations as name+ and name-, names ending 
+ * in '+' or '-' are not valid attribute names.
+ */
+static inline int
+aaa_value_op_key(const char *key, unsigned int len)
+{
+	return len && (key[len - 1] == '+' || key[len - 1] == '-');
+}
+
+/* the well-known id of the attribute or AAA_ATTR_KEY */
+static inline unsigned int
+aaa_attr_id(struct attr *a)
+{
+	if (a->id)
+		return a->id < AAA_ATTR_LAST ? a->id: AAA_ATTR_KEY;
+	return aaa_wire_attr_id(a->key, strlen(a->key));
+}
+
+struct acct_stats {
+	unsigned int live;
+	u64 expired;
+	double rate;
+};
+
 int acct_init(void);
 int acct_fini(void);
+int acct_expire(void);
+void acct_checkpoint(void);
+void acct_attach(void);
+void acct_recover(pid_t pid);
+int acct_lock(const char *sid);
+void acct_unlock(int handle);
+void acct_stats(struct acct_stats *stats);
 int session_bind(struct aaa *aaa, const char *id);
 int session_select(struct aaa *aaa, const char *id);
 int session_commit(struct aaa *aaa, const char *id);
 int session_touch(struct aaa *aaa, const char *id);
+int session_list(struct aaa *aaa);
 
 int
 udp_bind(struct aaa *aaa);
@@ -66,16 +150,49 @@ udp_bind(struct aaa *aaa);
 int
 udp_commit(struct aaa *aaa);
 
+int
+udp_exec(struct aaa *aaa, const char *ops);
+
+void
+udp_close(struct aaa *aaa);
+
+int
+udp_open(void);
+
+int
+udp_request_build(struct aaa *aaa, char *op, unsigned int id, byte *buf, int size);
+
+int
+udp_reply_parse(struct aaa *aaa, byte *packet, unsigned int len);
+
+unsigned int
+udp_reply_id(byte *packet, unsigned int len);
+
+timestamp_t
+udp_clock(void);
+
 int
 udp_validate(u8 *packet, int size);
 
 extern int (*aaa_server)(int argc, char *argv[]);
 
 extern const char *aaad_ip;
+extern int aaad_port;
+extern int aaad_workers;
+extern int aaad_batch;
+extern int aaad_timeout;
+extern int aaad_retransmit;
+extern int aaad_window;
+extern int aaad_wire;
+extern const char *aaad_store;
+extern int aaad_checkpoint;
 extern int aaa_packet_max;
 void
 aaa_env_init(void);
 
+void
+aaa_lib_init(void);
+
 void
 aaa_env_fini(void);
 #endif
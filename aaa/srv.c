@@ -11,6 +11,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sched.h>
+#include <linux/bpf_common.h>
 
 #include <sys/compiler.h>
 #include <sys/cpu.h>
@@ -31,6 +32,7 @@
 
 #include <aaa/lib.h>
 #include <aaa/prv.h>
+#include <aaa/wire.h>
 
 #define EV_API_STATIC 1
 #define EV_STANDALONE 1
@@ -54,7 +56,7 @@ static sig_atomic_t request_restart  = 0;
 static sig_atomic_t request_info     = 0;
 
 _unused static int sched_processes           = 1;
-_unused static int sched_workers             = 4;
+static int sched_workers                     = 4;
 _unused static int sched_gracefull_timeout   = 5; /* wait maximum secs for subprocesses */
 
 const char *pidfile = "/var/run/aaad.pid";
@@ -142,7 +144,10 @@ static void
 huphandler(int signo, siginfo_t *info, void *context)
 {
 	debug3("%d:%s processed", signo, strsignal(signo));
-	request_restart = 1;
+	if (signo == SIGUSR1)
+		request_info = 1;
+	else
+		request_restart = 1;
 }
 
 
@@ -199,6 +204,7 @@ chld_handler(EV_P_ ev_child *w, int revents)
 		if (WIFEXITED(w->rstatus) || WIFSIGNALED(w->rstatus)) {
 			task_disp.running--;
 			c->state = TASK_STATE_NONE;
+			acct_recover(w->rpid);
 		}
 	}
 
@@ -208,8 +214,7 @@ chld_handler(EV_P_ ev_child *w, int revents)
 static void
 timer(EV_P_ ev_timer *w, int revents)
 {
-//	debug3("timer");
-	//ev_timer_stop (EV_A_ w);
+	acct_checkpoint();
 }
 
 static void
@@ -248,36 +253,175 @@ signal_norace(struct task *task)
 #endif
 
 static int fd = -1;
-static int port = 8888;
+static int *udp_socks = NULL;
+static int udp_nsocks = 0;
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/* 
+ * <linux/filter.h> pulls <asm/types.h> which is shadowed by arch/x86/asm,
+ * the classic BPF structures are simple enough to keep them here.
+ */
+
+struct sock_filter {
+	u16 code;
+	u8  jt;
+	u8  jf;
+	u32 k;
+};
+
+struct sock_fprog {
+	unsigned short len;
+	struct sock_filter *filter;
+};
+
+#define BPF_A   0x10
+#define BPF_TAX 0x00
+
+#define BPF_STMT(code, k) { (unsigned short)(code), 0, 0, k }
+#define BPF_JUMP(code, k, jt, jf) { (unsigned short)(code), jt, jf, k }
+
+/*
+ * Classic BPF program selecting the reuseport socket by sess.id so that all
+ * requests for one session are served by the same worker regardless of the
+ * client's source port. Clients put sess.id on the first line of the
+ * datagram, the program hashes the value up to the first newline:
+ *
+ *   hash = hash * 31 + c
+ *
+ * and returns hash % workers. Binary datagrams carry the same hash in the
+ * header, see aaa_steer_hash(). Any other payload returns an out of range
+ * index and the kernel falls back to the default 4-tuple hash.
+ */
+
+#define STEER_SID_MAX 64
+#define STEER_HDR_LEN 12
+#define STEER_BYTE_LEN 8
+#define STEER_LEN (STEER_HDR_LEN + STEER_SID_MAX * STEER_BYTE_LEN + 3)
+
+static int
+udp_steer_attach(int sock, unsigned int workers)
+{
+	struct sock_filter code[STEER_LEN], *p = code;
+	unsigned int done = STEER_HDR_LEN + STEER_SID_MAX * STEER_BYTE_LEN;
+
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 0);
+	*p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AAA_WIRE_MAGIC, 0, 3);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, 8);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, 0);
+	*p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x73657373, 0, 2);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, 4);
+	*p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x2e69643a, 1, 0);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_IMM, 0);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+
+	for (unsigned int i = 0; i < STEER_SID_MAX; i++) {
+		unsigned int pc = STEER_HDR_LEN + i * STEER_BYTE_LEN;
+		*p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + i);
+		*p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, '\n', 0, 1);
+		*p++ = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, done - (pc + 3));
+		*p++ = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+		*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_MEM, 0);
+		*p++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 31);
+		*p++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+		*p++ = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+	}
+
+	*p++ = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_MEM, 0);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers);
+	*p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
 
-static void 
-udp_init(int index)
+	struct sock_fprog prog = { .len = p - code, .filter = code };
+	return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, 
+	                  &prog, sizeof(prog));
+}
+#else
+static int
+udp_steer_attach(int sock, unsigned int workers)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+#endif
+
+static int
+udp_socket(void)
 {
-	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+	int sock;
+	if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
 		die("Cannot create UDP socket: %s", strerror(errno));
 
 	int one = 1;
-	if (setsockopt(fd , SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
 		die("Cannot set SO_REUSEADDR: %s", strerror(errno));
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+		die("Cannot set SO_REUSEPORT: %s", strerror(errno));
 
-	struct timeval tv = {.tv_sec = 10, .tv_usec = 0 };
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv,sizeof(tv)) < 0)
+	/* idle workers wake up every second to expire sessions */
+	struct timeval tv = {.tv_sec = 1, .tv_usec = 0 };
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv,sizeof(tv)) < 0)
 		die("SO_RCVTIMEO");
 
 	struct sockaddr_in in = {
 		.sin_family = AF_INET,
-		.sin_port = htons(port + index),
+		.sin_port = htons(aaad_port),
 		.sin_addr.s_addr = INADDR_ANY
 	};
 
-	if (bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0)
+	if (bind(sock, (struct sockaddr *) &in, sizeof(in)) < 0)
 		die("Cannot bind udp socket: %s", strerror(errno));
 
+	return sock;
+}
+
+/*
+ * All worker sockets are created and bound by the dispatcher in worker order
+ * and stay open there, so the reuseport group and the socket indexes used by
+ * the steering program survive worker restarts.
+ */
+
+static void
+udp_init(int workers)
+{
+	udp_socks = malloc(workers * sizeof(*udp_socks));
+	udp_nsocks = workers;
+
+	for (int i = 0; i < workers; i++)
+		udp_socks[i] = udp_socket();
+
+	if (udp_steer_attach(udp_socks[0], workers) < 0)
+		error("reuseport steering disabled reason=%s", strerror(errno));
+
+	info("AAA/0 listening on port %d with %d worker(s)", aaad_port, workers);
+}
+
+static void
+udp_attach(int index)
+{
+	for (int i = 0; i < udp_nsocks; i++) {
+		if (i == index)
+			fd = udp_socks[i];
+		else
+			close(udp_socks[i]);
+	}
+
+	free(udp_socks);
+	udp_socks = NULL;
+	udp_nsocks = 0;
 }
 
 void
 udp_fini(void)
 {
+	for (int i = 0; i < udp_nsocks; i++)
+		close(udp_socks[i]);
+
+	free(udp_socks);
+	udp_socks = NULL;
+	udp_nsocks = 0;
+
 	if (fd != -1)
 		close(fd);
 	fd = -1;
@@ -318,23 +462,40 @@ udp_parse(struct msg *msg, byte *packet, unsigned int len)
 		*packet++ = 0;
 
 		debug3("udp parse %s:<%s>", key, value);
-		if (!strcmp(key, "sess.id"))
-			msg->sid = value;
-		if (!strcmp(key, "user.id"))
-			msg->uid = value;
-		if (strncmp(key, "msg.", 4)) {
-			aaa_attr_set(aaa, key, value);
+		unsigned int klen = value - key - 1;
+		if (klen >= 4 && !memcmp(key, "msg.", 4)) {
+			if (!strcmp(key, "msg.op"))
+				msg->op = value;
+			else if (!strcmp(key, "msg.id"))
+				msg->id = value;
 			continue;
 		}
 
-		if (!strcmp(key, "msg.op"))
-			msg->op = value;
-		else if (!strcmp(key, "msg.id"))
-			msg->id = value;
-		
+		if (klen > 64 || strlen(value) > 255)
+			continue;
+
+		/* value set operation */
+		if (klen > 1 && aaa_value_op_key(key, klen)) {
+			int del = key[klen - 1] == '-';
+			key[--klen] = 0;
+			if (!*value || strchr(value, ' '))
+				continue;
+			aaa_value_op(aaa, aaa_attr_lookup(aaa, key, klen, 
+			             AAA_ATTR_RECV), value, del);
+			continue;
+		}
+
+		struct attr *a = aaa_attr_lookup(aaa, key, klen, AAA_ATTR_RECV);
+		unsigned int id = aaa_attr_id(a);
+		if (id == AAA_ATTR_SESS_ID)
+			msg->sid = value;
+		else if (id == AAA_ATTR_USER_ID)
+			msg->uid = value;
+		a->val = mm_strdup(aaa->attrs.mm, value);
+		a->flags |= ATTR_CHANGED;
 	}
 
-	size_t sess_id_len = strlen(msg->sid);
+	size_t sess_id_len = msg->sid ? strlen(msg->sid): 0;
 	if (sess_id_len < 8 || sess_id_len > 64) {
 		error("invalid sess_id attribute");
 		return -1;
@@ -374,8 +535,8 @@ static inline int
 validate_key(char *key)
 {
 	size_t len = strlen(key);
-	if (len < 5)
-		return -1;
+	if (len < 5 || aaa_value_op_key(key, len))
+		goto invalid;
 	if (!strncmp(key, "sess.", 5))
 		return 0;
 	if (!strncmp(key, "user.", 5))
@@ -386,7 +547,7 @@ validate_key(char *key)
 		return 0;
 	if (!strncmp(key, "msg.", 4))
 		return 0;
-
+invalid:
 	error("invalid attr name: %s", key);
 	return -1;
 }
@@ -397,13 +558,13 @@ udp_build(struct msg *msg, byte *pkt, int size)
 	char *status = printfa("%d", msg->status);
 	int len = 0, rv;
 	len += attr_enc(pkt, len, size, "msg.status", status);
-	len += attr_enc(pkt, len, size, "msg.id", "1");
+	len += attr_enc(pkt, len, size, "msg.id", msg->id ? (char *)msg->id: "0");
 	debug3("msg.status:%s", status);
-	debug3("msg.id:%s", "1");
+	debug3("msg.id:%s", msg->id);
 
 	dict_for_each(a, msg->aaa->attrs.list) {
 		debug3("udp build %s:<%s>", a->key, a->val);
-		if (validate_key(a->key))
+		if (!a->id && validate_key(a->key))
 			return -1;
 		if ((rv = attr_enc(pkt, len, size, a->key, a->val)) < 5)
 			return -1;
@@ -413,6 +574,69 @@ udp_build(struct msg *msg, byte *pkt, int size)
 	return len;
 }
 
+static int
+wire_attr(void *ctx, unsigned int id, const char *key, const char *val,
+          unsigned int len)
+{
+	struct msg *msg = (struct msg *)ctx;
+	if (id == AAA_ATTR_SESS_ID)
+		msg->sid = val;
+	else if (id == AAA_ATTR_USER_ID)
+		msg->uid = val;
+
+	unsigned int klen = strlen(key);
+	if (klen > 64 || len > 255)
+		return 0;
+
+	int op = id == AAA_ATTR_ADD || id == AAA_ATTR_DEL;
+	if (op && (!*val || strchr(val, ' ')))
+		return 0;
+
+	struct attr *a = aaa_attr_lookup(msg->aaa, key, klen, AAA_ATTR_RECV);
+	if (op)
+		return aaa_value_op(msg->aaa, a, val, id == AAA_ATTR_DEL);
+
+	a->val = mm_strdup(msg->aaa->attrs.mm, val);
+	a->flags = (a->flags | ATTR_CHANGED) & ~ATTR_VALUES;
+	return 0;
+}
+
+static int
+wire_parse(struct msg *msg, byte *packet, unsigned int len)
+{
+	struct aaa_wire_hdr hdr;
+	if (aaa_wire_parse(packet, len, &hdr, wire_attr, msg))
+		return -1;
+
+	msg->wire = 1;
+	msg->seq  = hdr.id;
+	msg->nops = hdr.nops;
+	memcpy(msg->ops, hdr.ops, hdr.nops);
+
+	size_t sess_id_len = msg->sid ? strlen(msg->sid): 0;
+	if (sess_id_len < 8 || sess_id_len > 64) {
+		error("invalid sess_id attribute");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+wire_build(struct msg *msg, byte *pkt, int size)
+{
+	struct aaa_wire_hdr hdr = {
+		.op = msg->ops[0], .status = msg->status, .id = msg->seq
+	};
+
+	int len = aaa_wire_hdr(pkt, size, &hdr);
+	dict_for_each(a, msg->aaa->attrs.list)
+		if ((len = aaa_wire_put(pkt, len, size, a->key, a->val)) < 0)
+			return -1;
+
+	return len;
+}
+
 struct cmd {
 	struct msg msg;
 	const char *peer;
@@ -477,17 +701,25 @@ cmd_delete(struct cmd *cmd)
 	return 0;
 }
 
+static int
+cmd_list(struct cmd *cmd)
+{
+	struct msg *msg = &cmd->msg;
+	msg->status = 0;
+	return session_list(msg->aaa);
+}
+
 static const struct cmd_table {
 	const char *name;
 	int (*handler)(struct cmd *cmd);
-} cmd_table[] = {
-	{ "nop",    cmd_nop    },
-	{ "touch",  cmd_get    },
-	{ "bind",   cmd_bind   },
-	{ "select", cmd_select },
-	{ "commit", cmd_commit },
-	{ "delete", cmd_delete },
-	{ NULL,     NULL }
+} cmd_table[AAA_OP_LAST] = {
+	[AAA_OP_NOP]    = { "nop",    cmd_nop    },
+	[AAA_OP_TOUCH]  = { "touch",  cmd_touch  },
+	[AAA_OP_BIND]   = { "bind",   cmd_bind   },
+	[AAA_OP_SELECT] = { "select", cmd_select },
+	[AAA_OP_COMMIT] = { "commit", cmd_commit },
+	[AAA_OP_DELETE] = { "delete", cmd_delete },
+	[AAA_OP_LIST]   = { "list",   cmd_list   },
 };
 
 static int
@@ -496,38 +728,207 @@ cmd_execute(struct cmd *cmd, const struct cmd_table *d)
 	return d->handler(cmd);
 }
 
+/*
+ * Executes the operations of one datagram in order. The session is locked
+ * for the whole datagram, so no other request for the session can interleave
+ * even when it is served by another worker. The first failing operation 
+ * stops the batch and its status is returned to the client together with 
+ * the attributes.
+ */
+
 static int
 cmd_parse(struct cmd *cmd)
 {
 	struct msg *msg = &cmd->msg;
 
-	if (!msg->id || !msg->op)
-		return -EINVAL;
+	if (!msg->wire) {
+		int nops;
+		if (!msg->id || !msg->op)
+			return -EINVAL;
+		if ((nops = aaa_wire_ops(msg->ops, msg->op)) < 1)
+			return -EINVAL;
+		msg->nops = nops;
+	}
 
-	const struct cmd_table *d = cmd_table;
-	while (d->name && strcmp(msg->op, d->name))
-		d++;
-	if (d->handler)
-		return cmd_execute(cmd, d);
-	return -EINVAL;
+	int rv = 0, lock = acct_lock(msg->sid);
+	for (unsigned int i = 0; i < msg->nops; i++) {
+		const struct cmd_table *d = &cmd_table[msg->ops[i]];
+		if (!(rv = cmd_execute(cmd, d)))
+			continue;
+
+		debug2("sess.id=%s op=%s failed", msg->sid, d->name);
+		break;
+	}
+
+	acct_unlock(lock);
+	return rv;
+}
+
+/*
+ * Datagrams are drained in batches with recvmmsg(), replies are built into 
+ * a per-batch arena and sent with a single sendmmsg(). The batch size is 
+ * configurable with OPENAAA_BATCH, batch size 1 behaves like the classic 
+ * one datagram per syscall loop.
+ */
+
+#define UDP_BATCH_HIST 11
+
+struct udp_batch {
+	struct mm_pool *mp;
+	struct mmsghdr *rx;
+	struct mmsghdr *tx;
+	struct iovec *rx_iov;
+	struct iovec *tx_iov;
+	struct sockaddr_in *from;
+	byte *pkts;
+	unsigned int size;
+	u64 batches;
+	u64 packets;
+	u64 hist[UDP_BATCH_HIST];
+};
+
+static struct udp_batch udp_batch;
+
+static void
+udp_batch_init(struct udp_batch *b, unsigned int size)
+{
+	size = size < 1 ? 1: size > 1024 ? 1024: size;
+	memset(b, 0, sizeof(*b));
+
+	b->size   = size;
+	b->mp     = mm_pool_create(size * aaa_packet_max + CPU_PAGE_SIZE, 0);
+	b->rx     = calloc(size, sizeof(*b->rx));
+	b->tx     = calloc(size, sizeof(*b->tx));
+	b->rx_iov = calloc(size, sizeof(*b->rx_iov));
+	b->tx_iov = calloc(size, sizeof(*b->tx_iov));
+	b->from   = calloc(size, sizeof(*b->from));
+	b->pkts   = malloc(size * (aaa_packet_max + 1));
+
+	for (unsigned int i = 0; i < size; i++) {
+		b->rx_iov[i].iov_base = b->pkts + i * (aaa_packet_max + 1);
+		b->rx_iov[i].iov_len  = aaa_packet_max;
+	}
+}
+
+static void
+udp_batch_report(struct task *task, struct udp_batch *b)
+{
+	char hist[UDP_BATCH_HIST * 32], *p = hist;
+	*p = 0;
+
+	for (unsigned int i = 0; i < UDP_BATCH_HIST; i++) {
+		if (!b->hist[i])
+			continue;
+		if (i == 0)
+			p += snprintf(p, sizeof(hist) - (p - hist), " 1:%llu",
+			              (unsigned long long)b->hist[i]);
+		else
+			p += snprintf(p, sizeof(hist) - (p - hist), " %u-%u:%llu",
+			              1U << i, (2U << i) - 1, 
+			              (unsigned long long)b->hist[i]);
+	}
+
+	info("AAA/%d batch size=%u batches=%llu packets=%llu histogram:%s",
+	     task->index, b->size, (unsigned long long)b->batches, 
+	     (unsigned long long)b->packets, hist);
+}
+
+static void
+acct_report(struct task *task)
+{
+	struct acct_stats stats;
+	acct_stats(&stats);
+
+	info("AAA/%d sessions live=%u expired=%llu rate=%.1f/s", task->index,
+	     stats.live, (unsigned long long)stats.expired, stats.rate);
+}
+
+static void
+udp_batch_fini(struct udp_batch *b)
+{
+	mm_pool_destroy(b->mp);
+	free(b->rx);
+	free(b->tx);
+	free(b->rx_iov);
+	free(b->tx_iov);
+	free(b->from);
+	free(b->pkts);
+	memset(b, 0, sizeof(*b));
+}
+
+static inline void
+udp_batch_account(struct udp_batch *b, unsigned int count)
+{
+	unsigned int bucket = (sizeof(int) * 8 - 1) - __builtin_clz(count);
+	b->hist[__min(bucket, UDP_BATCH_HIST - 1)]++;
+	b->batches++;
+	b->packets += count;
+}
+
+static int
+udp_process(struct cmd *cmd, byte *pkt, ssize_t size, byte *reply)
+{
+	struct msg *msg = &cmd->msg;
+
+	if (udp_validate(pkt, (int)size))
+		return -1;
+
+	if (size >= aaa_packet_max) {
+		error("recvmmsg() overflow size: %d max: %d", (int)size, aaa_packet_max);
+		return -1;
+	}
+
+	pkt[size] = 0;
+
+	int wire = aaa_wire_is(pkt, (int)size);
+	if (wire && wire_parse(msg, pkt, (int)size) < 0)
+		return -1;
+	if (!wire && udp_parse(msg, pkt, (int)size) < 0)
+		return -1;
+
+	msg->status = cmd_parse(cmd);
+
+	if (wire)
+		size = wire_build(msg, reply, aaa_packet_max - 1);
+	else
+		size = udp_build(msg, reply, aaa_packet_max - 1);
+	if (size < 1)
+		return -1;
+
+	reply[size] = 0;
+	return (int)size;
 }
 
 static void
 udp_serve(struct task *task)
 {
+	struct udp_batch *b = &udp_batch;
 	struct cmd cmd;
 	struct msg *msg = &cmd.msg;
-	msg->aaa = (struct aaa *)task_user_get(task);
+	struct aaa *aaa = (struct aaa *)task_user_get(task);
+
+	if (request_info) {
+		request_info = 0;
+		udp_batch_report(task, b);
+		acct_report(task);
+	}
 
-	byte pkt[8192];
-	struct sockaddr_in from;
-	socklen_t len = sizeof(from);
+	acct_expire();
+
+	for (unsigned int i = 0; i < b->size; i++) {
+		b->rx[i].msg_hdr = (struct msghdr) {
+			.msg_name    = &b->from[i],
+			.msg_namelen = sizeof(b->from[i]),
+			.msg_iov     = &b->rx_iov[i],
+			.msg_iovlen  = 1
+		};
+	}
 
 	irq_enable();
-	ssize_t size = recvfrom(fd, pkt, sizeof(pkt), MSG_TRUNC, &from, &len);
+	int count = recvmmsg(fd, b->rx, b->size, MSG_WAITFORONE, NULL);
 	irq_disable();
 
-	if (size < 1 ) switch(errno) {
+	if (count < 1 ) switch(errno) {
 		case EAGAIN:
 			sched_idle(task);
 			return;
@@ -539,46 +940,57 @@ udp_serve(struct task *task)
 			return;
 	}
 
-	if (udp_validate(pkt, (int)size))
-		goto cleanup;
+	udp_batch_account(b, count);
 
-	if (size >= aaa_packet_max) {
-		error("recvfrom() overflow size: %d max: %d", (int)size, aaa_packet_max);
-		goto cleanup;
-	}
+	unsigned int replies = 0;
+	for (int i = 0; i < count; i++) {
+		byte *pkt = b->rx_iov[i].iov_base;
+		ssize_t size = b->rx[i].msg_len;
+		struct sockaddr_in *from = &b->from[i];
 
-	pkt[size] = 0;
+		memset(&cmd, 0, sizeof(cmd));
+		msg->aaa = aaa;
 
-	char *v = printfa("%s:%d", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
-	debug2("%s recv %jd byte(s)", v, (intmax_t)size);
+		debug2("%s:%d recv %jd byte(s)", inet_ntoa(from->sin_addr), 
+		       ntohs(from->sin_port), (intmax_t)size);
 
-	if (udp_parse(msg, pkt, (int)size) < 0)
-		goto cleanup;
-
-	if (cmd_parse(&cmd))
-		goto cleanup;
+		if (b->rx[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			error("recvmmsg() truncated datagram max: %d", aaa_packet_max);
+			continue;
+		}
 
-	if ((size = udp_build(msg, pkt, sizeof(pkt) - 1)) < 1)
-		goto cleanup;
+		byte *reply = mm_pool_alloc(b->mp, aaa_packet_max);
+		if ((size = udp_process(&cmd, pkt, size, reply)) > 0) {
+			b->tx_iov[replies] = (struct iovec) {
+				.iov_base = reply,
+				.iov_len  = size
+			};
+			b->tx[replies].msg_hdr = (struct msghdr) {
+				.msg_name    = from,
+				.msg_namelen = sizeof(*from),
+				.msg_iov     = &b->tx_iov[replies],
+				.msg_iovlen  = 1
+			};
+			replies++;
+		}
 
-	pkt[size] = 0;
-	if (size >= aaa_packet_max) {
-		error("sendto() overflow size: %d max: %d", (int)size, aaa_packet_max);
-		goto cleanup;
+		aaa_reset(aaa);
 	}
 
-	pkt[size] = 0;
-
-	int sent = sendto(fd, pkt, size, 0, &from, len);
-	debug2("%s sent %d byte(s)", v, sent);
+	for (unsigned int sent = 0; sent < replies; ) {
+		int rv = sendmmsg(fd, b->tx + sent, replies - sent, 0);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0) {
+			error("sendmmsg failed: reason=%s", strerror(errno));
+			break;
+		}
 
-	if (sent < 0)
-	        error("sendto failed: reason=%s", strerror(errno));
-	else if (sent < size)
-		error("sent partial packet (%d of %d bytes)", sent, (int)size);
+		debug2("sent %d datagram(s)", rv);
+		sent += rv;
+	}
 
-cleanup:
-	aaa_reset(msg->aaa);
+	mm_pool_flush(b->mp);
 }
 
 const char *
@@ -621,7 +1033,7 @@ task_init(struct task *task)
 		task->ppid = task->pid = getpid();
 		task->loop = ev_default_loop(0);
 		signal_norace(task);
-		ev_timer_init(&task->timer_watcher, timer, 5, 0.);
+		ev_timer_init(&task->timer_watcher, timer, 1., 1.);
 		ev_timer_start(task->loop, &task->timer_watcher);  
 		/* setup signal handlers */
 		ev_signal_init(&task->sigint_watcher,  sighandler, SIGINT);
@@ -643,12 +1055,12 @@ task_init(struct task *task)
 		sig_action(SIGHUP, huphandler);
 		sig_disable(SIGTERM);
 		sig_disable(SIGINT);
-		sig_disable(SIGUSR1);
 		sig_disable(SIGUSR2);
 		sig_ignore(SIGINT);
 		sig_ignore(SIGTERM);
-		udp_init(task->index - 1);
-		acct_init();
+		udp_attach(task->index - 1);
+		udp_batch_init(&udp_batch, aaad_batch);
+		acct_attach();
 		struct aaa *aaa = aaa_new(AAA_ENDPOINT_SERVER, 0);
 		task_user_set(task, aaa);
 
@@ -709,6 +1121,7 @@ init:
 			ev_loop_fork(EV_DEFAULT);
 			task_init(child);
 			sig_enable(SIGHUP);
+			sig_enable(SIGUSR1);
 			task_wait(child);
 			task_fini(child);
 			exit(0);
@@ -737,8 +1150,10 @@ again:
 			error("wait() reason=%s", strerror(errno));
 		else if (id == 0)
 			sleep(1);
-		else
+		else {
 			task_status(pid, status);
+			acct_recover(pid);
+		}
 	}
 
 	if (id == 0) {
@@ -762,11 +1177,15 @@ task_fini(struct task *task)
 	struct aaa *aaa;
 	switch (task->type) {
 	case TASK_TYPE_DISP:
+		udp_fini();
+		acct_fini();
 		break;
 	case TASK_TYPE_WORK:
 		aaa = (struct aaa *)task_user_get(task);
 		aaa_free(aaa);
-		acct_fini();
+		acct_report(task);
+		udp_batch_report(task, &udp_batch);
+		udp_batch_fini(&udp_batch);
 		udp_fini();
 		break;
 	default:
@@ -833,12 +1252,29 @@ restart(void)
 void
 sched_init(void)
 {
+	if (aaad_workers > 0)
+		sched_workers = aaad_workers;
+	else if ((sched_workers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		sched_workers = 1;
+
 	task_init(&task_disp);
 	task_disp.workers = sched_workers;
+	udp_init(sched_workers);
+	acct_init();
 	
 	configure();
 }
 
+static void
+report(void)
+{
+	request_info = 0;
+	dlist_for_each(task_disp.list, child, struct task, node) {
+		if (child->state != TASK_STATE_NONE)
+			kill(child->pid, SIGUSR1);
+	}
+}
+
 void
 sched_wait(void)
 {
@@ -847,6 +1283,8 @@ sched_wait(void)
 			break;
 		if (request_restart)
 			restart();
+		if (request_info)
+			report();
 
 		task_wait(&task_disp);
 	} while(1);
@@ -0,0 +1,367 @@
+#include <sys/compiler.h>
+#include <sys/log.h>
+#include <list.h>
+#include <mem/unaligned.h>
+#include <lv.h>
+#include <klv.h>
+#include <spinlock.h>
+#include <dict.h>
+
+#include <aaa/lib.h>
+#include <aaa/prv.h>
+#include <aaa/wire.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define ATTR(id, name) [id] = { { name, 0, id }, sizeof(name) - 1 }
+
+static struct wire_name {
+	struct dict_sym sym;
+	unsigned int len;
+} wire_attrs[AAA_ATTR_LAST] = {
+	[AAA_ATTR_KEY] = { { NULL, 0, 0 }, 0 },
+	ATTR(AAA_ATTR_SESS_ID,       "sess.id"),
+	ATTR(AAA_ATTR_SESS_CREATED,  "sess.created"),
+	ATTR(AAA_ATTR_SESS_MODIFIED, "sess.modified"),
+	ATTR(AAA_ATTR_SESS_EXPIRES,  "sess.expires"),
+	ATTR(AAA_ATTR_SESS_KEY,      "sess.key"),
+	ATTR(AAA_ATTR_USER_ID,       "user.id"),
+	ATTR(AAA_ATTR_USER_NAME,     "user.name"),
+	ATTR(AAA_ATTR_AUTH_TYPE,     "auth.type"),
+	ATTR(AAA_ATTR_AUTH_TRUST,    "auth.trust"),
+};
+
+/*
+ * Perfect hash of the well-known names, (key[0] + key[5] + len) & 15 maps
+ * each of them to a different slot. Must be updated with the names above.
+ */
+
+#define WIRE_PHASH(key, len) (((u8)(key)[0] + (u8)(key)[5] + (len)) & 15)
+
+static const u8 wire_phash[16] = {
+	[2]  = AAA_ATTR_SESS_CREATED,
+	[3]  = AAA_ATTR_SESS_ID,
+	[4]  = AAA_ATTR_SESS_EXPIRES,
+	[5]  = AAA_ATTR_USER_ID,
+	[6]  = AAA_ATTR_SESS_KEY,
+	[12] = AAA_ATTR_USER_NAME,
+	[13] = AAA_ATTR_SESS_MODIFIED,
+	[14] = AAA_ATTR_AUTH_TYPE,
+	[15] = AAA_ATTR_AUTH_TRUST,
+};
+
+/* the other names, never freed, slots are published with release stores */
+static struct {
+	spinlock lock;
+	unsigned int ready;
+	unsigned int count;
+	struct dict_sym *slot[AAA_ATTR_NAMES * 2];
+} wire_names;
+
+static const char *wire_ops[AAA_OP_LAST] = {
+	[AAA_OP_NOP]    = "nop",
+	[AAA_OP_TOUCH]  = "touch",
+	[AAA_OP_BIND]   = "bind",
+	[AAA_OP_SELECT] = "select",
+	[AAA_OP_COMMIT] = "commit",
+	[AAA_OP_DELETE] = "delete",
+	[AAA_OP_LIST]   = "list",
+};
+
+/*
+ * Must match the classic BPF program attached by the server, which hashes
+ * the first line of text datagrams the same way.
+ */
+
+u32
+aaa_steer_hash(const char *sid)
+{
+	u32 hash = 0;
+	for (unsigned int i = 0; sid[i] && i < 64; i++)
+		hash = hash * 31 + (u8)sid[i];
+	return hash;
+}
+
+const char *
+aaa_wire_op_name(unsigned int op)
+{
+	return op < AAA_OP_LAST ? wire_ops[op]: NULL;
+}
+
+int
+aaa_wire_op(const char *name)
+{
+	for (unsigned int op = 0; op < AAA_OP_LAST; op++)
+		if (!strcmp(wire_ops[op], name))
+			return op;
+	return -1;
+}
+
+/*
+ * Parses the ';' separated list of operation names, returns the number of
+ * operations or -1.
+ */
+
+int
+aaa_wire_ops(u8 *ops, const char *names)
+{
+	int nops = 0;
+	while (*names) {
+		const char *end = strchr(names, ';');
+		unsigned int len = end ? (unsigned int)(end - names): strlen(names);
+		unsigned int op;
+
+		for (op = 0; op < AAA_OP_LAST; op++)
+			if (!strncmp(wire_ops[op], names, len) && !wire_ops[op][len])
+				break;
+		if (op == AAA_OP_LAST || nops == AAA_WIRE_OPS)
+			return -1;
+
+		ops[nops++] = op;
+		if (!end)
+			break;
+		names = end + 1;
+	}
+
+	return nops ? nops: -1;
+}
+
+const char *
+aaa_wire_attr_name(unsigned int id)
+{
+	return id < AAA_ATTR_LAST ? wire_attrs[id].sym.key: NULL;
+}
+
+unsigned int
+aaa_wire_attr_id(const char *key, unsigned int len)
+{
+	if (len < 7)
+		return AAA_ATTR_KEY;
+
+	unsigned int id = wire_phash[WIRE_PHASH(key, len)];
+	if (id && wire_attrs[id].len == len && 
+	    !memcmp(wire_attrs[id].sym.key, key, len))
+		return id;
+	return AAA_ATTR_KEY;
+}
+
+static inline int
+wire_valid_key(const char *key, unsigned int len)
+{
+	if (len < 5 || len > 255 || aaa_value_op_key(key, len))
+		return 0;
+	if (!memcmp(key, "sess.", 5) || !memcmp(key, "user.", 5) ||
+	    !memcmp(key, "auth.", 5) || !memcmp(key, "acct.", 5))
+		return 1;
+	return 0;
+}
+
+static void
+wire_names_init(void)
+{
+	spin_lock(&wire_names.lock);
+	if (!wire_names.ready) {
+		for (unsigned int id = 1; id < AAA_ATTR_LAST; id++)
+			wire_attrs[id].sym.hash = dict_hash(wire_attrs[id].sym.key);
+		__sync_synchronize();
+		wire_names.ready = 1;
+	}
+	spin_unlock(&wire_names.lock);
+}
+
+static struct dict_sym *
+wire_names_find(const char *key, unsigned int len, u32 hash, u32 *at)
+{
+	u32 mask = array_size(wire_names.slot) - 1, i = hash & mask;
+	struct dict_sym *sym;
+	for (; (sym = atomic_load_acquire(&wire_names.slot[i])); i = (i + 1) & mask)
+		if (sym->hash == hash && !strncmp(sym->key, key, len) &&
+		    !sym->key[len])
+			break;
+	*at = i;
+	return sym;
+}
+
+const struct dict_sym *
+aaa_wire_attr_sym(unsigned int id)
+{
+	if (!*(volatile unsigned int *)&wire_names.ready)
+		wire_names_init();
+	return id && id < AAA_ATTR_LAST ? &wire_attrs[id].sym: NULL;
+}
+
+/*
+ * Returns the interned name of the attribute @key of @len bytes, NULL when
+ * the name is not valid, is not interned and @create is not set, or the 
+ * table is full. Lookups do not take the lock.
+ */
+
+const struct dict_sym *
+aaa_attr_intern(const char *key, unsigned int len, int create)
+{
+	if (!*(volatile unsigned int *)&wire_names.ready)
+		wire_names_init();
+
+	unsigned int id = aaa_wire_attr_id(key, len);
+	if (id != AAA_ATTR_KEY)
+		return &wire_attrs[id].sym;
+	if (!wire_valid_key(key, len))
+		return NULL;
+
+	u32 hash = (u32)hash_buffer(key, len), at;
+	struct dict_sym *sym = wire_names_find(key, len, hash, &at);
+	if (sym || !create)
+		return sym;
+
+	spin_lock(&wire_names.lock);
+	if ((sym = wire_names_find(key, len, hash, &at)))
+		goto unlock;
+	if (wire_names.count == AAA_ATTR_NAMES)
+		goto unlock;
+	if (!(sym = malloc(sizeof(*sym) + len + 1)))
+		goto unlock;
+
+	char *name = (char *)(sym + 1);
+	memcpy(name, key, len);
+	name[len] = 0;
+	sym->key  = name;
+	sym->hash = hash;
+	sym->id   = AAA_ATTR_LAST + wire_names.count++;
+	atomic_store_release(&wire_names.slot[at], sym);
+unlock:
+	spin_unlock(&wire_names.lock);
+	return sym;
+}
+
+int
+aaa_wire_hdr(byte *buf, int size, struct aaa_wire_hdr *hdr)
+{
+	int batch = hdr->nops > 1;
+	int len = AAA_WIRE_HDR + (batch ? 1 + hdr->nops: 0);
+	if (size < len || hdr->nops > AAA_WIRE_OPS)
+		return -1;
+
+	buf[0] = AAA_WIRE_MAGIC;
+	buf[1] = AAA_WIRE_VERSION;
+	buf[2] = batch ? AAA_OP_BATCH: (u8)hdr->op;
+	buf[3] = (u8)(s8)hdr->status;
+	put_u32_be(buf + 4, hdr->id);
+	put_u32_be(buf + 8, hdr->hash);
+
+	if (batch) {
+		buf[AAA_WIRE_HDR] = (u8)hdr->nops;
+		memcpy(buf + AAA_WIRE_HDR + 1, hdr->ops, hdr->nops);
+	}
+
+	return len;
+}
+
+static int
+wire_put(byte *buf, int len, int size, unsigned int id, const char *key, 
+         const char *val)
+{
+	unsigned int klen = strlen(key), vlen = strlen(val);
+	byte *payload = buf + len;
+	int avail = size - len;
+
+	if (len < 0 || vlen > 0xffff)
+		goto cleanup;
+	if ((id == AAA_ATTR_KEY || id >= AAA_ATTR_LAST) && 
+	    !wire_valid_key(key, klen))
+		goto cleanup;
+
+	CHECK_AVAIL(1, avail, -1);
+	*payload = (u8)id;
+	MOVE_PAYLOAD(payload, avail, 1);
+
+	if (id == AAA_ATTR_KEY || id >= AAA_ATTR_LAST) {
+		PUT_LV_STR_U8(payload, avail, key, klen);
+	}
+
+	PUT_LV_STR_BE16(payload, avail, val, vlen);
+	return (int)(payload - buf);
+cleanup:
+	error("attr encode key: %s val: <%s> len: %d failed", key, val, len);
+	return -1;
+}
+
+int
+aaa_wire_put(byte *buf, int len, int size, const char *key, const char *val)
+{
+	return wire_put(buf, len, size, aaa_wire_attr_id(key, strlen(key)), 
+	                key, val);
+}
+
+int
+aaa_wire_put_value(byte *buf, int len, int size, const char *key, 
+                   const char *val, int del)
+{
+	return wire_put(buf, len, size, del ? AAA_ATTR_DEL: AAA_ATTR_ADD, 
+	                key, val);
+}
+
+/*
+ * Visits the attributes in place, fn is called with the key and the NUL
+ * terminated value for every attribute. The well-known keys are resolved to
+ * their interned names, the value set operations come with their own id.
+ */
+
+int
+aaa_wire_parse(byte *buf, int len, struct aaa_wire_hdr *hdr,
+               aaa_wire_fn fn, void *ctx)
+{
+	if (!aaa_wire_is(buf, len) || buf[1] != AAA_WIRE_VERSION)
+		return -EPROTO;
+
+	hdr->op     = buf[2];
+	hdr->status = (s8)buf[3];
+	hdr->id     = get_u32_be(buf + 4);
+	hdr->hash   = get_u32_be(buf + 8);
+
+	byte *payload = buf + AAA_WIRE_HDR;
+	int avail = len - AAA_WIRE_HDR;
+
+	hdr->nops = 1;
+	hdr->ops[0] = hdr->op;
+	if (hdr->op == AAA_OP_BATCH) {
+		CHECK_AVAIL(1, avail, -EPROTO);
+		hdr->nops = *payload;
+		CHECK_AVAIL(1 + hdr->nops, avail, -EPROTO);
+		if (!hdr->nops || hdr->nops > AAA_WIRE_OPS)
+			return -EPROTO;
+		memcpy(hdr->ops, payload + 1, hdr->nops);
+		MOVE_PAYLOAD(payload, avail, 1 + hdr->nops);
+		hdr->op = hdr->ops[0];
+	}
+
+	for (unsigned int i = 0; i < hdr->nops; i++)
+		if (hdr->ops[i] >= AAA_OP_LAST)
+			return -EPROTO;
+
+	while (avail > 0) {
+		unsigned int id = *payload;
+		MOVE_PAYLOAD(payload, avail, 1);
+
+		if (id == AAA_ATTR_KEY || id == AAA_ATTR_ADD || id == AAA_ATTR_DEL) {
+			VISIT_KLV_STR_BE16(payload, avail, key, klen, val, vlen, {
+				if (!wire_valid_key(key, klen))
+					return -EPROTO;
+				if (fn(ctx, id, key, val, vlen))
+					return -EINVAL;
+			});
+			continue;
+		}
+
+		if (id >= AAA_ATTR_LAST)
+			return -EPROTO;
+
+		VISIT_LV_STR_BE16(payload, avail, val, vlen, {
+			if (fn(ctx, id, wire_attrs[id].sym.key, val, vlen))
+				return -EINVAL;
+		});
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * (AAA) Autentication, Authorisation and Accounting) Library
+ *
+ * The MIT License (MIT)         Copyright (c) 2015 Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __AAA_WIRE_H__
+#define __AAA_WIRE_H__
+
+#include <sys/compiler.h>
+#include <dict.h>
+
+/*
+ * Binary framing of the aaad datagrams. The first byte of a text datagram is
+ * always a printable character, the binary one starts with AAA_WIRE_MAGIC.
+ *
+ *   u8 magic, u8 version, u8 op, s8 status, be32 msg.id, be32 steer hash
+ *
+ * The header is followed by the attributes. Well-known attributes are sent
+ * as their numeric id followed by the value with be16 length, the others as
+ * id 0 followed by the key with u8 length and the value with be16 length.
+ * Both the key and the value are NUL terminated on the wire so the parser
+ * hands them out in place.
+ *
+ * The steer hash is computed from sess.id by aaa_steer_hash(), the server
+ * uses it to select the worker without parsing the payload.
+ */
+
+#define AAA_WIRE_MAGIC   0xAA
+#define AAA_WIRE_VERSION 1
+#define AAA_WIRE_HDR     12
+
+enum aaa_wire_op {
+	AAA_OP_NOP         = 0,
+	AAA_OP_TOUCH       = 1,
+	AAA_OP_BIND        = 2,
+	AAA_OP_SELECT      = 3,
+	AAA_OP_COMMIT      = 4,
+	AAA_OP_DELETE      = 5,
+	AAA_OP_LIST        = 6,
+	AAA_OP_LAST,
+	AAA_OP_BATCH       = 0x7f
+};
+
+/*
+ * A datagram may carry an ordered list of operations, in the text protocol
+ * separated by ';' in msg.op (bind;touch;commit). In the binary one the 
+ * header op is AAA_OP_BATCH and the header is followed by u8 count and the
+ * opcodes. The server executes them in order on one session and stops at
+ * the first failure.
+ */
+
+#define AAA_WIRE_OPS     8
+
+enum aaa_wire_attr {
+	AAA_ATTR_KEY           = 0,
+	AAA_ATTR_SESS_ID       = 1,
+	AAA_ATTR_SESS_CREATED  = 2,
+	AAA_ATTR_SESS_MODIFIED = 3,
+	AAA_ATTR_SESS_EXPIRES  = 4,
+	AAA_ATTR_SESS_KEY      = 5,
+	AAA_ATTR_USER_ID       = 6,
+	AAA_ATTR_USER_NAME     = 7,
+	AAA_ATTR_AUTH_TYPE     = 8,
+	AAA_ATTR_AUTH_TRUST    = 9,
+	AAA_ATTR_LAST,
+	AAA_ATTR_ADD           = 0xfe,
+	AAA_ATTR_DEL           = 0xff
+};
+
+/*
+ * Values added to or removed from a multi-valued attribute travel as
+ * operations the server applies to the stored set. The text protocol sends
+ * them as the key followed by '+' or '-', the binary one as id AAA_ATTR_ADD
+ * or AAA_ATTR_DEL followed by the key and the value as for id 0.
+ */
+
+/*
+ * Attribute names are interned once per process. The well-known names are
+ * resolved by a perfect hash of their length and two characters, the other
+ * valid names are added to a fixed table on first use and get the ids from
+ * AAA_ATTR_LAST up. The ids past the well-known ones are local to the 
+ * process, the wire and the session store keep those names as text.
+ */
+
+#define AAA_ATTR_NAMES   4096
+
+struct aaa_wire_hdr {
+	unsigned int op;
+	int status;
+	unsigned int id;
+	u32 hash;
+	unsigned int nops;
+	u8 ops[AAA_WIRE_OPS];
+};
+
+typedef int (*aaa_wire_fn)(void *ctx, unsigned int id, const char *key,
+                           const char *val, unsigned int len);
+
+u32
+aaa_steer_hash(const char *sid);
+
+const char *
+aaa_wire_op_name(unsigned int op);
+
+int
+aaa_wire_op(const char *name);
+
+int
+aaa_wire_ops(u8 *ops, const char *names);
+
+const char *
+aaa_wire_attr_name(unsigned int id);
+
+unsigned int
+aaa_wire_attr_id(const char *key, unsigned int len);
+
+const struct dict_sym *
+aaa_wire_attr_sym(unsigned int id);
+
+const struct dict_sym *
+aaa_attr_intern(const char *key, unsigned int len, int create);
+
+int
+aaa_wire_hdr(byte *buf, int size, struct aaa_wire_hdr *hdr);
+
+int
+aaa_wire_put(byte *buf, int len, int size, const char *key, const char *val);
+
+int
+aaa_wire_put_value(byte *buf, int len, int size, const char *key, 
+                   const char *val, int del);
+
+int
+aaa_wire_parse(byte *buf, int len, struct aaa_wire_hdr *hdr,
+               aaa_wire_fn fn, void *ctx);
+
+static inline int
+aaa_wire_is(const byte *buf, int len)
+{
+	return len >= AAA_WIRE_HDR && buf[0] == AAA_WIRE_MAGIC;
+}
+
+#endif
@@ -29,10 +29,14 @@
 #include <dict.h>
 
 #include <mem/pool.h>
+#include <mem/slab.h>
 #include <mem/stack.h>
 
 #include <dlfcn.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/plt/plthook.h>
 #include <net/tls/ext.h>
 
@@ -45,6 +49,7 @@
 
 #include <aaa/lib.h>
 #include <aaa/prv.h>
+#include <aaa/handler.h>
 
 #ifdef CONFIG_WIN32
 #include <windows.h>                                                            
@@ -55,6 +60,13 @@
 #include <link.h>
 #endif
 
+#ifndef CONFIG_WIN32
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+extern char **environ;
+#endif
+
 #ifdef CONFIG_ARM
 #include <link.h>
 #endif
@@ -65,6 +77,7 @@
 #include <openssl/bio.h>
 #include <openssl/tls1.h>
 #include <openssl/x509.h>
+#include <openssl/async.h>
 
 #include <crypto/abi/ssl.h>
 
@@ -136,6 +149,11 @@ DEFINE_ABI(SSL_SESSION_set_timeout);
 DEFINE_ABI(SSL_SESSION_get_timeout);
 DEFINE_ABI(SSL_set_verify_result);
 DEFINE_ABI(SSL_shutdown);
+DEFINE_ABI(ASYNC_get_current_job);
+DEFINE_ABI(ASYNC_get_wait_ctx);
+DEFINE_ABI(ASYNC_WAIT_CTX_set_wait_fd);
+DEFINE_ABI(ASYNC_WAIT_CTX_clear_fd);
+DEFINE_ABI(ASYNC_pause_job);
 
 struct cf_tls_rfc5705 {
 	char *context;
@@ -184,6 +202,31 @@ struct ssl_aaa {
 
 struct ssl_aaa aaa;
 
+/* in-process handler module, see aaa/handler.h */
+struct ssl_handler {
+	void *dll;
+	aaa_handler_authenticate_t authenticate;
+	aaa_handler_close_t close;
+};
+
+static struct ssl_handler handler;
+
+/*
+ * Each thread registers sessions with one aaa context and transport and 
+ * recycles the per-connection sessions with their pools through its slab.
+ */
+
+#define SSL_SESSION_SLAB 256
+
+struct ssl_thread {
+	struct aaa *aaa;
+	struct mem_slab sessions;
+};
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static __thread struct ssl_thread *thread_ctx;
+
 struct aaa_keys {
 	struct bb binding_key;
 	struct bb binding_id;
@@ -197,7 +240,9 @@ struct session {
 	SSL_CTX *ctx;
 	SSL *ssl;
 	X509 *cert;
-	char *tls_binding_key;
+	char *tls_binding_key;           /* hex, formatted once per handshake */
+	char *tls_binding_id;
+	char *tls_session_id;
 	char *aaa_binding_key;
 	enum ssl_endpoint_type endpoint;
 };
@@ -278,12 +323,67 @@ done:
 	CALL_SSL(set_info_callback)((SSL *)ssl, ssl_info);
 }
 
+static void
+session_free(void *obj)
+{
+	struct session *sp = obj;
+	mm_pool_destroy(sp->mp);
+}
+
+static void
+thread_free(void *ctx)
+{
+	struct ssl_thread *t = ctx;
+	if (t->aaa)
+		aaa_free(t->aaa);
+	mem_slab_destroy(&t->sessions);
+	free(t);
+	thread_ctx = NULL;
+}
+
+static void
+thread_init(void)
+{
+	pthread_key_create(&thread_key, thread_free);
+}
+
+static struct ssl_thread *
+thread_get(void)
+{
+	if (thread_ctx)
+		return thread_ctx;
+
+	pthread_once(&thread_once, thread_init);
+	thread_ctx = calloc(1, sizeof(*thread_ctx));
+	if (!thread_ctx)
+		die("Can not allocate memory size=%jd", (intmax_t)sizeof(*thread_ctx));
+
+	mem_slab_init(&thread_ctx->sessions, sizeof(struct session),
+	              SSL_SESSION_SLAB, session_free);
+	pthread_setspecific(thread_key, thread_ctx);
+	return thread_ctx;
+}
+
+static struct aaa *
+thread_aaa(void)
+{
+	struct ssl_thread *t = thread_get();
+	if (t->aaa) {
+		aaa_reset(t->aaa);
+		return t->aaa;
+	}
+
+	return t->aaa = aaa_new(AAA_ENDPOINT_SERVER, 0);
+}
+
+/* recycled sessions come with their pool flushed */
 static struct session *
 session_init(const SSL *ssl)
 {
-	struct mm_pool *mp = mm_pool_create(CPU_PAGE_SIZE, 0);
-	struct session *sp = mm_pool_zalloc(mp, sizeof(*sp));
+	struct session *sp = mem_slab_alloc(&thread_get()->sessions);
+	struct mm_pool *mp = sp->mp ? sp->mp: mm_pool_create(CPU_PAGE_SIZE, 0);
 
+	memset(sp, 0, sizeof(*sp));
 	dict_init(&sp->recved, mm_pool(mp));
 	dict_init(&sp->posted, mm_pool(mp));
 
@@ -300,7 +400,8 @@ session_fini(struct session *sp)
 {
 	SSL *ssl = sp->ssl;
 	SSL_SESS_SET(ssl, NULL);
-	mm_pool_destroy(sp->mp);
+	mm_pool_flush(sp->mp);
+	mem_slab_free(&thread_get()->sessions, sp);
 }
 
 static struct session *
@@ -328,10 +429,16 @@ export_keying_material(struct session *sp)
 	return 0;
 }
 
+static inline char *
+session_hex(struct session *sp, const void *addr, size_t len)
+{
+	char *str = mm_pool_alloc(sp->mp, memhex_size(len));
+	return memhex((char *)addr, len, str);
+}
+
 static void
 ssl_exportkeys(struct session *sp)
 {
-	char *bind_key, *bind_id, *sess_id;
 	struct aaa_keys *a = &sp->keys;
 
 	if (!a->binding_key.len || !a->binding_id.len)
@@ -341,25 +448,24 @@ ssl_exportkeys(struct session *sp)
 	unsigned int len;
 	const byte *id = CALL_ABI(SSL_SESSION_get_id)(sess, &len);
 	
-	bind_key = evala(memhex, a->binding_key.addr, a->binding_key.len);
-	debug3("tls_binding_key=%s", bind_key);
-	bind_id = evala(memhex, a->binding_id.addr, a->binding_id.len);
-	debug3("tls_binding_id=%s", bind_id);
-	sess_id = evala(memhex, (char *)id, len);
+	sp->tls_binding_id = session_hex(sp, a->binding_id.addr, a->binding_id.len);
+	sp->tls_session_id = session_hex(sp, id, len);
+	debug3("tls_binding_key=%s", sp->tls_binding_key);
+	debug3("tls_binding_id=%s", sp->tls_binding_id);
 
 	/* tls_session_id is empty for tls tickets for client */
 	/* this is hack for no_session_id cases (vpn) */
-	if (sess_id && *sess_id)
-		debug3("tls_session_id=%s", sess_id);
+	if (*sp->tls_session_id)
+		debug3("tls_session_id=%s", sp->tls_session_id);
 	else
-		sess_id = bind_key;
+		sp->tls_session_id = sp->tls_binding_key;
 
+	/* the only session registration of the handshake */
 	if (sp->endpoint == TLS_EP_SERVER || server_always) {
-		struct aaa *usr = aaa_new(AAA_ENDPOINT_SERVER, 0);
-		aaa_attr_set(usr, "sess.id", sess_id);
-		aaa_attr_set(usr, "sess.key",bind_key);
+		struct aaa *usr = thread_aaa();
+		aaa_attr_set(usr, "sess.id", sp->tls_session_id);
+		aaa_attr_set(usr, "sess.key", sp->tls_binding_key);
 		aaa_bind(usr);
-		aaa_free(usr);
 	}
 }
 
@@ -375,10 +481,13 @@ ssl_derive_keys(struct session *sp)
 	struct sha1 sha1;
 	sha1_init(&sha1);
 
+	/* the binding id hashes the hex binding key in compat mode */
+	sp->tls_binding_key = 
+		session_hex(sp, a->binding_key.addr, a->binding_key.len);
+
 #define OPENAAA_COMPAT 1
 #ifdef  OPENAAA_COMPAT
-	key = evala(memhex, a->binding_key.addr, a->binding_key.len);
-	sha1_update(&sha1, key, strlen(key));
+	sha1_update(&sha1, sp->tls_binding_key, a->binding_key.len * 2);
 #else
 	sha1_update(&sha1, a->binding_key.addr, a->binding_key.len);
 #endif
@@ -653,40 +762,118 @@ ssl_setsession(struct session *sp)
 }
 */
 
+#ifndef CONFIG_WIN32
+/*
+ * The handler runs in a child process while the async job is paused, the
+ * application polls the pidfd of the child from SSL_get_all_async_fds() and
+ * resumes the handshake when the child exits. The pidfd is not inherited,
+ * descendants of the handler outliving it do not keep the job paused. 
+ * Without pidfd_open() the job waits for the child blocking the thread.
+ */
+static int
+handler_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1;
+#endif
+}
+
+static int
+handler_exec_async(ASYNC_JOB *job, const char *cmd)
+{
+	ASYNC_WAIT_CTX *ctx = CALL_ABI(ASYNC_get_wait_ctx)(job);
+	char *argv[] = { "sh", "-c", (char *)cmd, NULL };
+	int status = -1;
+	pid_t pid;
+
+	if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ))
+		return -1;
+
+	int fd = handler_pidfd(pid);
+	if (fd >= 0)
+		CALL_ABI(ASYNC_WAIT_CTX_set_wait_fd)(ctx, &handler, fd, NULL, NULL);
+
+	pid_t rv = 0;
+	while (fd >= 0 && (rv = waitpid(pid, &status, WNOHANG)) != pid) {
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0 || !CALL_ABI(ASYNC_pause_job)())
+			break;
+	}
+
+	if (fd >= 0) {
+		CALL_ABI(ASYNC_WAIT_CTX_clear_fd)(ctx, &handler);
+		close(fd);
+	}
+
+	if (rv != pid)
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	return status;
+}
+#endif
+
+/* 
+ * Executes the handler program, within an async job (SSL_MODE_ASYNC) without
+ * blocking the thread.
+ */
+static int
+handler_exec(const char *cmd)
+{
+#ifndef CONFIG_WIN32
+	ASYNC_JOB *job = EXISTS_ABI(ASYNC_get_current_job) ?
+	                 CALL_ABI(ASYNC_get_current_job)(): NULL;
+	if (job && EXISTS_ABI(ASYNC_pause_job))
+		return handler_exec_async(job, cmd);
+#endif
+	return system(cmd);
+}
+
+static int
+ssl_server_handler(struct session *sp, char *sess_id, char *id, char *key)
+{
+	struct aaa_handler_args args = {
+		.endpoint    = AAA_ENDPOINT_SERVER,
+		.authority   = aaa.authority,
+		.sess_id     = sess_id,
+		.binding_id  = id,
+		.binding_key = key,
+		.group       = aaa.group,
+		.role        = aaa.role
+	};
+
+	int status = handler.authenticate(&args);
+	debug1("%s", status ? "forbidden" : "authenticated");
+
+	if (!status || !server_handshake_synch)
+		return 0;
+
+	CALL_SSL(set_verify_result)(sp->ssl, X509_V_ERR_APPLICATION_VERIFICATION);
+	CALL_SSL(shutdown)(sp->ssl);
+	return X509_V_ERR_APPLICATION_VERIFICATION;
+}
+
 static int
 ssl_server_aaa(struct session *sp)
 {
-	struct aaa_keys *a = &sp->keys;
-	char *key = evala(memhex, a->binding_key.addr, a->binding_key.len);
-	char *id  = evala(memhex, a->binding_id.addr, a->binding_id.len);
+	char *key = sp->tls_binding_key;
+	char *id  = sp->tls_binding_id;
+	char *sess_id = sp->tls_session_id;
 
 	const char *proto_attr   = aaa_attr_names[AAA_ATTR_PROTOCOL];
 	const char *proto_client = dict_get(&sp->recved, proto_attr);
 	const char *proto_server = aaa.protocol;
 
 	SSL_SESSION *sess = CALL_ABI(SSL_get_session)(sp->ssl);
-	unsigned int len;
-	const byte *sessid = CALL_ABI(SSL_SESSION_get_id)(sess, &len);
-	char *sess_id = evala(memhex, (char *)sessid, len);
-
 	long timeout = CALL_ABI(SSL_SESSION_get_timeout)(sess);
 	info("ssl.timeout: %ld", timeout);
 
-	struct aaa *usr = aaa_new(AAA_ENDPOINT_SERVER, 0);
-
-	if (!sess_id || !*sess_id)
-		sess_id = key;
-
 	info("aaa.authority=%s", aaa.authority);
 	info("aaa.handler=%s", aaa.handler);
 
 	info("protocol server=%s client=%s", proto_server, proto_client);
 
-	aaa_attr_set(usr, "sess.id", sess_id);
-	aaa_attr_set(usr, "sess.key", key);
-	aaa_bind(usr);
-	aaa_free(usr);
-
 	if (!proto_client || !proto_server)
 		return -EINVAL;
 	if (strcmp(proto_client, proto_server))
@@ -698,6 +885,9 @@ ssl_server_aaa(struct session *sp)
 //
 	debug2("handshake_synch=%s",  server_handshake_synch ? "yes": "no");
 
+	if (handler.authenticate)
+		return ssl_server_handler(sp, sess_id, id, key);
+
 	char *synch = "";
 #ifdef CONFIG_LINUX	
 	synch = server_handshake_synch ? "" : "&";
@@ -711,7 +901,7 @@ ssl_server_aaa(struct session *sp)
 		msg = printfa("%s -pri -a%s -i%s -k%s", 
 		              aaa.handler, host, id, key);
 	
-	_unused int status = system(msg);
+	_unused int status = handler_exec(msg);
 	debug1("%s", WEXITSTATUS(status)? "failed" : "channel binding");
 
 	if (aaa.group && aaa.role)
@@ -723,12 +913,12 @@ ssl_server_aaa(struct session *sp)
 
 	debug1("cmd=%s", msg);
 	
-	status = system(msg);
-
-	if (!server_handshake_synch)
-		debug1("%s", WEXITSTATUS(status)? "forbidden" : "authenticated");
+	status = server_handshake_synch ? handler_exec(msg): system(msg);
+	status = status == -1 || !WIFEXITED(status) || WEXITSTATUS(status);
+	debug1("%s", status ? "forbidden" : "authenticated");
 
-	if (!server_handshake_synch)
+	/* the exit status decides as aaa_handler_authenticate() of a module */
+	if (!status || !server_handshake_synch)
 		return 0;
 
 	CALL_SSL(set_verify_result)(sp->ssl, X509_V_ERR_APPLICATION_VERIFICATION);
@@ -741,9 +931,8 @@ ssl_client_aaa(struct session *sp)
 {
 	const char *authority = dict_get(&sp->recved, "aaa.authority");
 
-	struct aaa_keys *a = &sp->keys;
-	char *key = evala(memhex, a->binding_key.addr, a->binding_key.len);
-	char *id  = evala(memhex, a->binding_id.addr,  a->binding_id.len);
+	char *key = sp->tls_binding_key;
+	char *id  = sp->tls_binding_id;
 
 	authority = authority ? authority : aaa.authority;
 	debug4("authority=%s", authority);
@@ -752,6 +941,16 @@ ssl_client_aaa(struct session *sp)
 	if (!aaa.handler || !key || !id || !authority)
 		return -EINVAL;
 
+	if (handler.authenticate) {
+		struct aaa_handler_args args = {
+			.endpoint    = AAA_ENDPOINT_CLIENT,
+			.authority   = authority,
+			.binding_id  = id,
+			.binding_key = key
+		};
+		return handler.authenticate(&args);
+	}
+
 #ifdef CONFIG_WIN32
 	const char *pre = "START /B ", *end = "";
 	const char *msg = printfa("%s %s -k%s -i%s -prx -a%s %s", 
@@ -1128,6 +1327,45 @@ import_target(void *dll)
 	plthook_close(plt);
 }
 
+static void
+handler_close(void)
+{
+	if (handler.close)
+		handler.close();
+	dlclose(handler.dll);
+	memset(&handler, 0, sizeof(handler));
+}
+
+/* the handler is loaded when it is a shared object, otherwise executed */
+static void
+handler_load(const char *file)
+{
+	size_t len = file ? strlen(file): 0;
+	if (handler.dll || len < 3 || strcmp(file + len - 3, ".so"))
+		return;
+
+	void *dll = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+	if (!dll) {
+		error("handler %s: %s", file, dlerror());
+		return;
+	}
+
+	aaa_handler_init_t init = dlsym(dll, AAA_HANDLER_INIT);
+	handler.authenticate = dlsym(dll, AAA_HANDLER_AUTHENTICATE);
+	handler.close = dlsym(dll, AAA_HANDLER_CLOSE);
+
+	if (!handler.authenticate || (init && init())) {
+		error("handler %s: initialization failed", file);
+		memset(&handler, 0, sizeof(handler));
+		dlclose(dll);
+		return;
+	}
+
+	handler.dll = dll;
+	atexit(handler_close);
+	debug1("handler %s loaded", file);
+}
+
 static void
 init_aaa_env(void)
 {
@@ -1155,6 +1393,8 @@ init_aaa_env(void)
 		debug1("env aaa.protocol=%s",aaa.protocol);
 	if (aaa.handler)
 		debug1("env aaa.handler=%s",aaa.handler);
+
+	handler_load(aaa.handler);
 	if (aaa.group)
 		debug1("env aaa.group=%s",aaa.group);
 	if (aaa.role)
@@ -1227,6 +1467,11 @@ ssl_init(int server)
 	IMPORT_ABI(SSL_SESSION_get_timeout);
 	IMPORT_ABI(SSL_set_verify_result);
 	IMPORT_ABI(SSL_shutdown);
+	IMPORT_ABI(ASYNC_get_current_job);
+	IMPORT_ABI(ASYNC_get_wait_ctx);
+	IMPORT_ABI(ASYNC_WAIT_CTX_set_wait_fd);
+	IMPORT_ABI(ASYNC_WAIT_CTX_clear_fd);
+	IMPORT_ABI(ASYNC_pause_job);
 
 	init_aaa_env();
 	aaa_env_init();
@@ -1343,6 +1588,11 @@ crypto_lookup(void)
 	IMPORT_ABI(SSL_SESSION_get_timeout);
 	IMPORT_ABI(SSL_set_verify_result);
 	IMPORT_ABI(SSL_shutdown);
+	IMPORT_ABI(ASYNC_get_current_job);
+	IMPORT_ABI(ASYNC_get_wait_ctx);
+	IMPORT_ABI(ASYNC_WAIT_CTX_set_wait_fd);
+	IMPORT_ABI(ASYNC_WAIT_CTX_clear_fd);
+	IMPORT_ABI(ASYNC_pause_job);
 
 	import_target(dll);
 
@@ -25,6 +25,10 @@
 #include <crypto/hex.h>
 #include <ctype.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static const char hextab[] = "0123456789abcdef";\
 
 static unsigned int 
@@ -34,12 +38,51 @@ hexp(unsigned int c)
 	return (c < 10) ? c : (c - 7);
 }
 
+#ifdef __SSE2__
+/*
+ * Encodes 16 bytes per step: the nibbles are split and interleaved, then
+ * mapped to '0'..'9' and 'a'..'f' by adding '0' and 39 more above 9.
+ */
+static inline size_t
+memhex_sse2(const byte *in, size_t bytes, char *out)
+{
+	const __m128i mask  = _mm_set1_epi8(0x0f);
+	const __m128i nine  = _mm_set1_epi8(9);
+	const __m128i digit = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	size_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16, out += 32) {
+		__m128i v  = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i lo = _mm_and_si128(v, mask);
+		__m128i a  = _mm_unpacklo_epi8(hi, lo);
+		__m128i b  = _mm_unpackhi_epi8(hi, lo);
+
+		a = _mm_add_epi8(_mm_add_epi8(a, digit),
+		                 _mm_and_si128(_mm_cmpgt_epi8(a, nine), alpha));
+		b = _mm_add_epi8(_mm_add_epi8(b, digit),
+		                 _mm_and_si128(_mm_cmpgt_epi8(b, nine), alpha));
+
+		_mm_storeu_si128((__m128i *)out, a);
+		_mm_storeu_si128((__m128i *)(out + 16), b);
+	}
+
+	return i;
+}
+#endif
+
 char *
 memhex(char *src, size_t bytes, char *dst)
 {
 	char *_ds = dst;
 	const byte *in = (const byte*)src;
-	for (unsigned i = 0; i < bytes; i++) {
+	unsigned i = 0;
+#ifdef __SSE2__
+	i = memhex_sse2(in, bytes, _ds);
+	_ds += i * 2;
+#endif
+	for (; i < bytes; i++) {
 		*_ds++ = hextab[in[i] >> 4];
 		*_ds++ = hextab[in[i] & 0xf];
 	} 
@@ -31,6 +31,9 @@
 #define atomic_set_bit(P, V) __sync_or_and_fetch((P), 1<<(V))
 #define atomic_clear_bit(P, V) __sync_and_and_fetch((P), ~(1<<(V)))
 
+#define atomic_load_acquire(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define atomic_store_release(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+
 #define barrier()   asm volatile("": : :"memory")
 #define cpu_relax() asm volatile("pause\n": : :"memory")
 
@@ -30,10 +30,26 @@
 #include <mem/alloc.h>
 #include <mem/pool.h>
 #include <list.h>
+#include <hash.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #define ATTR_CHANGED 0x1
+#define ATTR_VALUES  0x2
+#define DICT_BITS    4
+
+/*
+ * Attributes are kept in a list in the order they were set, dict_for_each()
+ * walks the list. Lookups go through an open addressing index of the same
+ * attributes keyed by the precomputed hash of the key. The index is created
+ * by the first insert, doubles when it is 3/4 full and deleted slots are
+ * refilled by shifting the rest of the cluster back.
+ *
+ * The owner of the dict may intern its keys as struct dict_sym, an interned
+ * key is referenced instead of copied, matches by address and its id is
+ * kept in the attribute. Attributes of keys not interned have id 0.
+ */
 
 #define dict_for_each(it, list) \
 	for (struct attr *(it) = \
@@ -41,69 +57,239 @@
 	     (it) != __container_of(&(list).head,      struct attr, node); \
 	     (it)  = __container_of( (it)->node.next,  struct attr, node))
 
+struct dict_sym {
+	const char *key;
+	u32 hash;
+	u32 id;
+};
+
+struct dict_vals;
+
 struct attr {
 	struct node node;
 	char *key;
 	char *val;
 	int flags;
+	u32 hash;
+	u32 id;
+	struct dict_vals *vals;
 };
 
 struct dict {
 	struct dlist list;
 	struct mm *mm;
+	struct attr **slot;
+	u32 mask;
+	u32 count;
 };
 
 static inline void
 dict_init(struct dict *dict, struct mm *mm)
 {
 	dict->mm = mm;
+	dict->slot = NULL;
+	dict->mask = 0;
+	dict->count = 0;
 	dlist_init(&dict->list);
 }
 
+/* moves the attributes and the index of @src to @dst, @src is left empty */
 static inline void
-dict_sort(struct dict *dict)
+dict_move(struct dict *dst, struct dict *src)
 {
-	struct node *x, *y, *z;
-	for (x = dlist_head(&dict->list); x; ) {
-		for (z = y = x; (y = dlist_next(&dict->list, y)); ) {
-			struct attr *a = __container_of(y, struct attr, node);
-			struct attr *b = __container_of(z, struct attr, node);
-			if (strcmp(a->key, b->key) < 0)
-				z = y;
-		}
-		if (x == z)
-			x = dlist_next(&dict->list, x);
-		else {
-			dlist_del(z);
-			dlist_add_before(z, x);
-		}
+	*dst = *src;
+	dlist_init(&dst->list);
+	if (!dlist_empty(&src->list)) {
+		dst->list.head.next = src->list.head.next;
+		dst->list.head.prev = src->list.head.prev;
+		dst->list.head.next->prev = &dst->list.head;
+		dst->list.head.prev->next = &dst->list.head;
+	}
+
+	dict_init(src, src->mm);
+}
+
+static inline u32
+dict_hash(const char *key)
+{
+	return (u32)hash_string(key);
+}
+
+static inline void
+dict_index_add(struct attr **slot, u32 mask, struct attr *a)
+{
+	u32 i = a->hash & mask;
+	while (slot[i])
+		i = (i + 1) & mask;
+	slot[i] = a;
+}
+
+static inline void
+dict_grow(struct dict *dict)
+{
+	u32 size = dict->slot ? (dict->mask + 1) * 2: 1U << DICT_BITS;
+	struct attr **slot = mm_zalloc(dict->mm, size * sizeof(*slot));
+
+	for (u32 i = 0; dict->slot && i <= dict->mask; i++)
+		if (dict->slot[i])
+			dict_index_add(slot, size - 1, dict->slot[i]);
+
+	if (dict->slot)
+		mm_free(dict->mm, dict->slot);
+	dict->slot = slot;
+	dict->mask = size - 1;
+}
+
+static inline void
+dict_index_del(struct dict *dict, struct attr *a)
+{
+	u32 mask = dict->mask, hole = a->hash & mask, i;
+	while (dict->slot[hole] != a)
+		hole = (hole + 1) & mask;
+
+	dict->slot[hole] = NULL;
+	for (i = (hole + 1) & mask; dict->slot[i]; i = (i + 1) & mask) {
+		u32 home = dict->slot[i]->hash & mask;
+		/* the slot may move to the hole unless home is in (hole, i] */
+		if (hole <= i ? (hole < home && home <= i):
+		                (hole < home || home <= i))
+			continue;
+		dict->slot[hole] = dict->slot[i];
+		dict->slot[i] = NULL;
+		hole = i;
 	}
+
+	dict->count--;
 }
 
 static inline struct attr *
-dict_lookup(struct dict *dict, const char *key, int create)
+dict_find(struct dict *dict, const char *key, u32 hash)
 {
-	dict_for_each(a, dict->list)
-		if (!strcmp(a->key, key))
-			return a;
-	if (!create)
+	if (!dict->slot)
 		return NULL;
 
+	for (u32 i = hash & dict->mask; dict->slot[i]; i = (i + 1) & dict->mask)
+		if (dict->slot[i]->hash == hash && (dict->slot[i]->key == key ||
+		    !strcmp(dict->slot[i]->key, key)))
+			return dict->slot[i];
+	return NULL;
+}
+
+static inline struct attr *
+dict_add(struct dict *dict, char *key, u32 hash)
+{
+	if ((dict->count + 1) * 4 > (dict->mask + 1) * 3 || !dict->slot)
+		dict_grow(dict);
+
 	struct attr *a = mm_alloc(dict->mm, sizeof(*a));
-	a->key = mm_strdup(dict->mm, key);
+	a->key = key;
+	a->val = NULL;
+	a->hash = hash;
+	a->id = 0;
+	a->vals = NULL;
 	a->node.next = NULL;
 	a->node.prev = NULL;
 	a->flags = 0;
 	dlist_add(&dict->list, &a->node);
+	dict_index_add(dict->slot, dict->mask, a);
+	dict->count++;
+	return a;
+}
+
+static inline void
+dict_del(struct dict *dict, struct attr *a)
+{
+	dlist_del(&a->node);
+	dict_index_del(dict, a);
+}
+
+static inline struct node *
+dict_merge(struct node *a, struct node *b)
+{
+	struct node *head = NULL, **tail = &head;
+	while (a && b) {
+		struct attr *x = __container_of(a, struct attr, node);
+		struct attr *y = __container_of(b, struct attr, node);
+		if (strcmp(x->key, y->key) <= 0) {
+			*tail = a;
+			a = a->next;
+		} else {
+			*tail = b;
+			b = b->next;
+		}
+		tail = &(*tail)->next;
+	}
+
+	*tail = a ? a: b;
+	return head;
+}
+
+/*
+ * Bottom-up merge sort of the list by key, part[k] holds a sorted run of 
+ * 2^k attributes. The index is not affected.
+ */
+
+static inline void
+dict_sort(struct dict *dict)
+{
+	struct node *part[32] = { NULL }, *it, *next;
+	if (dict->count < 2)
+		return;
+
+	dict->list.head.prev->next = NULL;
+	for (it = dict->list.head.next; it; it = next) {
+		next = it->next;
+		it->next = NULL;
+
+		unsigned int k;
+		for (k = 0; part[k]; k++) {
+			it = dict_merge(part[k], it);
+			part[k] = NULL;
+		}
+		part[k] = it;
+	}
+
+	struct node *sorted = NULL;
+	for (unsigned int k = 0; k < array_size(part); k++)
+		if (part[k])
+			sorted = dict_merge(part[k], sorted);
+
+	dlist_init(&dict->list);
+	for (it = sorted; it; it = next) {
+		next = it->next;
+		dlist_add_tail(&dict->list, it);
+	}
+}
+
+static inline struct attr *
+dict_lookup(struct dict *dict, const char *key, int create)
+{
+	u32 hash = dict_hash(key);
+	struct attr *a = dict_find(dict, key, hash);
+	if (a || !create)
+		return a;
+
+	return dict_add(dict, mm_strdup(dict->mm, key), hash);
+}
+
+static inline struct attr *
+dict_lookup_sym(struct dict *dict, const struct dict_sym *sym, int create)
+{
+	struct attr *a = dict_find(dict, sym->key, sym->hash);
+	if (!a && create)
+		a = dict_add(dict, (char *)sym->key, sym->hash);
+	if (a && sym->id)
+		a->id = sym->id;
 	return a;
 }
 
 static inline void
 dict_set(struct dict *dict, const char *key, const char *val)
 {
-	struct attr *a = dict_lookup(dict, key, 1);
+	struct attr *a = dict_lookup(dict, key, !!val);
 	if (!val) {
-		dlist_del(&a->node);
+		if (a)
+			dict_del(dict, a);
 		return;
 	}
 	a->val = mm_strdup(dict->mm, val);
@@ -134,6 +320,141 @@ dict_set_nf(struct dict *dict, const char *key, const char *val)
 	a->val = val ? mm_strdup(dict->mm, val) : NULL;
 }
 
+/*
+ * Multi-valued attributes keep their values in one string separated by 
+ * spaces. The values are split and sorted on the first membership test and
+ * the result is kept with the attribute until its value is replaced, the 
+ * next tests are a binary search. Values added or removed by 
+ * dict_vals_update() are stored sorted and unique.
+ */
+
+struct dict_vals {
+	const char *src;
+	unsigned int count;
+	const char *val[];
+};
+
+static inline int
+dict_vals_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static inline struct dict_vals *
+dict_vals(struct dict *dict, struct attr *a)
+{
+	const char *src = a->val ? a->val: "";
+	if (a->vals && a->vals->src == src)
+		return a->vals;
+
+	unsigned int max = 1, count = 0;
+	for (const char *p = src; *p; p++)
+		max += *p == ' ';
+
+	struct dict_vals *v = mm_alloc(dict->mm, sizeof(*v) + max * sizeof(char *));
+	char *buf = mm_strdup(dict->mm, src);
+	for (char *p = buf; *p; ) {
+		if (*p == ' ') {
+			*p++ = 0;
+			continue;
+		}
+		v->val[count++] = p;
+		while (*p && *p != ' ')
+			p++;
+	}
+
+	qsort(v->val, count, sizeof(v->val[0]), dict_vals_cmp);
+	v->count = 0;
+	for (unsigned int i = 0; i < count; i++)
+		if (!v->count || strcmp(v->val[v->count - 1], v->val[i]))
+			v->val[v->count++] = v->val[i];
+
+	v->src = src;
+	return a->vals = v;
+}
+
+/* returns 1 when @val is present, @at is where it is or would be */
+static inline int
+dict_vals_find(struct dict_vals *v, const char *val, unsigned int *at)
+{
+	unsigned int lo = 0, hi = v->count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		int cmp = strcmp(v->val[mid], val);
+		if (!cmp) {
+			*at = mid;
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*at = lo;
+	return 0;
+}
+
+static inline int
+dict_has_value(struct dict *dict, struct attr *a, const char *val)
+{
+	unsigned int at;
+	return dict_vals_find(dict_vals(dict, a), val, &at);
+}
+
+static inline char *
+dict_vals_put(char *p, char *out, const char *val)
+{
+	size_t len = strlen(val);
+	if (p != out)
+		*p++ = ' ';
+	memcpy(p, val, len);
+	return p + len;
+}
+
+/* adds or removes @val, returns 1 when the set was changed */
+static inline int
+dict_vals_update(struct dict *dict, struct attr *a, const char *val, int del)
+{
+	struct dict_vals *v = dict_vals(dict, a);
+	unsigned int at;
+	if (dict_vals_find(v, val, &at) != del)
+		return 0;
+
+	size_t size = strlen(val) + 1;
+	for (unsigned int i = 0; i < v->count; i++)
+		size += strlen(v->val[i]) + 1;
+
+	char *out = mm_alloc(dict->mm, size), *p = out;
+	for (unsigned int i = 0; i <= v->count; i++) {
+		const char *it = i < v->count ? v->val[i]: NULL;
+		if (i == at && !del)
+			p = dict_vals_put(p, out, val);
+		if (it && !(i == at && del))
+			p = dict_vals_put(p, out, it);
+	}
+	*p = 0;
+
+	a->val = out;
+	return 1;
+}
+
+/* membership test on a value string which is not kept in a dict */
+static inline int
+dict_value_has(const char *vals, const char *val)
+{
+	size_t len = strlen(val);
+	for (const char *p = vals; p && *p; ) {
+		while (*p == ' ')
+			p++;
+		const char *end = strchr(p, ' ');
+		size_t n = end ? (size_t)(end - p): strlen(p);
+		if (n == len && n && !memcmp(p, val, n))
+			return 1;
+		p = end;
+	}
+	return 0;
+}
+
 static inline const char *
 dict_get(struct dict *dict, const char *key)
 {
@@ -0,0 +1,290 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __GENERIC_HINDEX_H__
+#define __GENERIC_HINDEX_H__
+
+#include <sys/compiler.h>
+#include <sys/cpu.h>
+#include <mem/vm.h>
+#include <string.h>
+
+/*
+ * Open addressing index mapping 64-bit fingerprints to 32-bit references
+ * (page numbers). Slots are 16 bytes so a cache line holds four of them and
+ * a lookup usually touches one line. The fingerprint is kept in the slot,
+ * the referenced object is only compared when the fingerprints match.
+ *
+ * Linear probing, deleted slots are refilled by shifting the rest of the
+ * cluster back so no tombstones accumulate.
+ *
+ * The table doubles when it is 3/4 full. The resize is incremental: the old
+ * table is kept and every insert or delete moves HINDEX_MIGRATE of its slots
+ * to the new table, lookups search both until the old one is drained. Slots
+ * of the old table are only marked as moved, never emptied, so the probe
+ * sequences of the slots not moved yet stay intact.
+ *
+ * An index created by hindex_init_fixed() lives in memory provided by the
+ * caller, e.g. shared by several processes, and never grows. The caller 
+ * sizes it for the maximum number of references.
+ */
+
+#define HINDEX_NONE    (u32)~0U
+#define HINDEX_EMPTY   0ULL
+#define HINDEX_MOVED   1ULL
+#define HINDEX_MIGRATE 16
+
+struct hindex_slot {
+	u64 fp;
+	u32 ref;
+	u32 aux;
+};
+
+struct hindex_table {
+	struct hindex_slot *slot;
+	u32 mask;
+	u32 used;
+};
+
+struct hindex {
+	struct hindex_table cur;
+	struct hindex_table old;
+	u32 migrate;
+	u32 count;
+	u32 fixed;
+};
+
+typedef int (*hindex_match_t)(void *ctx, u32 ref);
+
+static inline u64
+hindex_fp(u64 hash)
+{
+	return hash > HINDEX_MOVED ? hash: hash + 2;
+}
+
+static inline size_t
+hindex_table_size(u32 mask)
+{
+	return ((size_t)mask + 1) * sizeof(struct hindex_slot);
+}
+
+static inline void
+hindex_table_init(struct hindex_table *t, unsigned int bits)
+{
+	t->mask = (1U << bits) - 1;
+	t->used = 0;
+	t->slot = vm_page_alloc(hindex_table_size(t->mask));
+}
+
+static inline void
+hindex_table_free(struct hindex_table *t)
+{
+	if (t->slot)
+		vm_page_free(t->slot, hindex_table_size(t->mask));
+	t->slot = NULL;
+	t->used = 0;
+}
+
+static inline void
+hindex_init(struct hindex *idx, unsigned int bits)
+{
+	memset(idx, 0, sizeof(*idx));
+	hindex_table_init(&idx->cur, __max(bits, 4U));
+}
+
+static inline void
+hindex_init_fixed(struct hindex *idx, unsigned int bits, void *slots)
+{
+	memset(idx, 0, sizeof(*idx));
+	memset(slots, 0, ((size_t)1 << bits) * sizeof(struct hindex_slot));
+	idx->cur.mask = (1U << bits) - 1;
+	idx->cur.slot = (struct hindex_slot *)slots;
+	idx->fixed = 1;
+}
+
+static inline void
+hindex_free(struct hindex *idx)
+{
+	if (idx->fixed)
+		return;
+	hindex_table_free(&idx->cur);
+	hindex_table_free(&idx->old);
+}
+
+static inline u32
+hindex_table_find(struct hindex_table *t, u64 fp, hindex_match_t match,
+                  void *ctx)
+{
+	for (u32 i = (u32)fp & t->mask; t->slot[i].fp; i = (i + 1) & t->mask)
+		if (t->slot[i].fp == fp && match(ctx, t->slot[i].ref))
+			return t->slot[i].ref;
+	return HINDEX_NONE;
+}
+
+static inline void
+hindex_table_add(struct hindex_table *t, u64 fp, u32 ref)
+{
+	u32 i = (u32)fp & t->mask;
+	while (t->slot[i].fp)
+		i = (i + 1) & t->mask;
+	t->slot[i].fp  = fp;
+	t->slot[i].ref = ref;
+	t->used++;
+}
+
+/* backward shift deletion for linear probing */
+static inline void
+hindex_table_shift(struct hindex_table *t, u32 hole)
+{
+	u32 i = hole;
+	for (;;) {
+		t->slot[hole].fp = HINDEX_EMPTY;
+		for (;;) {
+			i = (i + 1) & t->mask;
+			if (!t->slot[i].fp)
+				return;
+			u32 home = (u32)t->slot[i].fp & t->mask;
+			/* the slot may move to the hole unless home is in (hole, i] */
+			if (hole <= i ? (hole < home && home <= i):
+			                (hole < home || home <= i))
+				continue;
+			break;
+		}
+		t->slot[hole] = t->slot[i];
+		hole = i;
+	}
+}
+
+static inline int
+hindex_table_del(struct hindex_table *t, u64 fp, u32 ref, int moved)
+{
+	for (u32 i = (u32)fp & t->mask; t->slot[i].fp; i = (i + 1) & t->mask) {
+		if (t->slot[i].fp != fp || t->slot[i].ref != ref)
+			continue;
+		if (moved)
+			t->slot[i].fp = HINDEX_MOVED;
+		else
+			hindex_table_shift(t, i);
+		t->used--;
+		return 0;
+	}
+	return -1;
+}
+
+static inline void
+hindex_migrate(struct hindex *idx, unsigned int steps)
+{
+	struct hindex_table *old = &idx->old;
+	if (!old->slot)
+		return;
+
+	for (; steps && idx->migrate <= old->mask; steps--, idx->migrate++) {
+		struct hindex_slot *s = &old->slot[idx->migrate];
+		if (s->fp <= HINDEX_MOVED)
+			continue;
+		hindex_table_add(&idx->cur, s->fp, s->ref);
+		s->fp = HINDEX_MOVED;
+		old->used--;
+	}
+
+	if (idx->migrate > old->mask)
+		hindex_table_free(old);
+}
+
+static inline void
+hindex_grow(struct hindex *idx)
+{
+	/* finish the previous resize first, this is rare */
+	while (idx->old.slot)
+		hindex_migrate(idx, ~0U);
+
+	unsigned int bits = 1;
+	while ((1U << bits) <= idx->cur.mask)
+		bits++;
+
+	idx->old = idx->cur;
+	idx->migrate = 0;
+	hindex_table_init(&idx->cur, bits + 1);
+}
+
+/*
+ * Returns the reference of the first slot with fingerprint @fp accepted by
+ * @match or HINDEX_NONE.
+ */
+
+static inline u32
+hindex_find(struct hindex *idx, u64 fp, hindex_match_t match, void *ctx)
+{
+	u32 ref = hindex_table_find(&idx->cur, fp, match, ctx);
+	if (ref == HINDEX_NONE && idx->old.slot)
+		ref = hindex_table_find(&idx->old, fp, match, ctx);
+	return ref;
+}
+
+/*
+ * Calls @fn for the reference of every slot with fingerprint @fp, the index
+ * may hold the same fingerprint many times. @fn must not modify the index.
+ */
+
+static inline void
+hindex_walk(struct hindex *idx, u64 fp, hindex_match_t fn, void *ctx)
+{
+	struct hindex_table *t = &idx->cur;
+	for (u32 i = (u32)fp & t->mask; t->slot[i].fp; i = (i + 1) & t->mask)
+		if (t->slot[i].fp == fp)
+			fn(ctx, t->slot[i].ref);
+
+	if (!(t = &idx->old)->slot)
+		return;
+	for (u32 i = (u32)fp & t->mask; t->slot[i].fp; i = (i + 1) & t->mask)
+		if (t->slot[i].fp == fp)
+			fn(ctx, t->slot[i].ref);
+}
+
+static inline void
+hindex_add(struct hindex *idx, u64 fp, u32 ref)
+{
+	if (!idx->fixed && (idx->cur.used + 1) * 4 > (idx->cur.mask + 1) * 3)
+		hindex_grow(idx);
+
+	hindex_table_add(&idx->cur, fp, ref);
+	hindex_migrate(idx, HINDEX_MIGRATE);
+	idx->count++;
+}
+
+static inline int
+hindex_del(struct hindex *idx, u64 fp, u32 ref)
+{
+	int rv = hindex_table_del(&idx->cur, fp, ref, 0);
+	if (rv && idx->old.slot)
+		rv = hindex_table_del(&idx->old, fp, ref, 1);
+	if (rv)
+		return rv;
+
+	hindex_migrate(idx, HINDEX_MIGRATE);
+	idx->count--;
+	return 0;
+}
+
+#endif/*__GENERIC_HINDEX_H__*/
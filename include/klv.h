@@ -7,6 +7,7 @@
 
 #include <sys/compiler.h>
 #include <mem/unaligned.h>
+#include <lv.h>
 
 /* Run block on fixed size string */
 #define VISIT_KLV_STR_U8(payload, avail, lv, block)
@@ -14,8 +15,13 @@
 /* Run block on fixed size string in native order */
 #define VISIT_KLV_STR_U16(payload, avail, lv, block)
 
-/* Run block on fixed size string in big endian order */
-#define VISIT_KLV_STR_BE16(payload, avail, lv, block) \
+/* 
+ * Run block on the key with 8-bit length and the value in big endian order,
+ * both are NUL terminated.
+ */
+#define VISIT_KLV_STR_BE16(payload, avail, key, klen, val, vlen, block) \
+	VISIT_LV_STR_U8(payload, avail, key, klen,                      \
+		VISIT_LV_STR_BE16(payload, avail, val, vlen, block))
 
 /* Run block on fixed size string in little endian order */
 #define VISIT_KLV_STR_LE16(payload, avail, lv, block) \
@@ -6,14 +6,38 @@
 #include <sys/compiler.h>
 #include <mem/unaligned.h>
 
+/*
+ * The string visitors expect the value followed by a NUL byte which is not 
+ * counted in the length, the block can use the value in place as a C string.
+ * The payload is moved past the terminator before the block runs.
+ */
+
 /* Run block on fixed size string */
-#define VISIT_LV_STR_U8(payload, avail, lv, block)
+#define VISIT_LV_STR_U8(payload, avail, ptr, len, block)             \
+{                                                                    \
+	CHECK_AVAIL(1, avail, -1);                                   \
+	unsigned int len = *((u8*)payload);                          \
+	char *ptr = (char *)(((u8*)payload) + 1);                    \
+	CHECK_AVAIL(len + 2, avail, -1);                             \
+	if (ptr[len]) return -1;                                     \
+	MOVE_PAYLOAD(payload, avail, len + 2);                       \
+	block                                                        \
+}
 
 /* Run block on fixed size string in native order */
 #define VISIT_LV_STR_U16(payload, avail, lv, block)
 
 /* Run block on fixed size string in big endian order */
-#define VISIT_LV_STR_BE16(payload, avail, lv, block) \
+#define VISIT_LV_STR_BE16(payload, avail, ptr, len, block)           \
+{                                                                    \
+	CHECK_AVAIL(2, avail, -1);                                   \
+	unsigned int len = get_u16_be(payload);                      \
+	char *ptr = (char *)(((u8*)payload) + 2);                    \
+	CHECK_AVAIL(len + 3, avail, -1);                             \
+	if (ptr[len]) return -1;                                     \
+	MOVE_PAYLOAD(payload, avail, len + 3);                       \
+	block                                                        \
+}
 
 /* Run block on fixed size string in little endian order */
 #define VISIT_LV_STR_LE16(payload, avail, lv, block) \
@@ -169,4 +193,20 @@
 #define CHECK_LV_SIZE_LIMIT(size, limit) \
 	if (size > limit) return -EPROTO
 
+/* Append NUL terminated string with the 8-bit length prefix */
+#define PUT_LV_STR_U8(payload, avail, str, len)                      \
+	CHECK_AVAIL(len + 2, avail, -1);                             \
+	*((u8*)payload) = (u8)len;                                   \
+	memcpy(((u8*)payload) + 1, str, len);                        \
+	((u8*)payload)[len + 1] = 0;                                 \
+	MOVE_PAYLOAD(payload, avail, len + 2)
+
+/* Append NUL terminated string with the big endian 16-bit length prefix */
+#define PUT_LV_STR_BE16(payload, avail, str, len)                    \
+	CHECK_AVAIL(len + 3, avail, -1);                             \
+	put_u16_be(payload, len);                                    \
+	memcpy(((u8*)payload) + 2, str, len);                        \
+	((u8*)payload)[len + 2] = 0;                                 \
+	MOVE_PAYLOAD(payload, avail, len + 3)
+
 #endif
@@ -26,22 +26,90 @@
 #include <errno.h>
 #include <atomic.h>
 
+/*
+ * Spinlocks usable in memory shared by processes. The lock word holds the
+ * owner, 1 for spin_lock() or any non-zero id passed to spin_lock_owner(),
+ * so the locks held by a process which died can be found and released.
+ */
+
 typedef unsigned spinlock;
 
+static inline int
+spin_trylock_owner(spinlock *lock, unsigned owner)
+{
+	return cmpxchg(lock, 0, owner) ? EBUSY: 0;
+}
+
+static inline void
+spin_lock_owner(spinlock *lock, unsigned owner)
+{
+	while (spin_trylock_owner(lock, owner))
+		while (*(volatile spinlock *)lock)
+			cpu_relax();
+}
+
 static inline void
 spin_lock(spinlock *lock)
 {
+	spin_lock_owner(lock, 1);
+}
+
+static inline int
+spin_trylock(spinlock *lock)
+{
+	return spin_trylock_owner(lock, 1);
 }
 
 static inline void
 spin_unlock(spinlock *lock)
 {
+	__sync_lock_release(lock);
 }
 
-static int
-spin_trylock(spinlock *lock)
+/* releases the lock if it is held by @owner */
+static inline int
+spin_unlock_owner(spinlock *lock, unsigned owner)
+{
+	return cmpxchg(lock, owner, 0) == owner;
+}
+
+/*
+ * Sequence counter for readers which never block the writer. The writer
+ * serialized by a lock makes the counter odd while it modifies the data,
+ * readers retry when the counter changed during their read.
+ */
+
+typedef unsigned seqcount;
+
+static inline unsigned
+read_seqbegin(seqcount *seq)
+{
+	unsigned start;
+	while ((start = *(volatile seqcount *)seq) & 1)
+		cpu_relax();
+	__sync_synchronize();
+	return start;
+}
+
+static inline int
+read_seqretry(seqcount *seq, unsigned start)
+{
+	__sync_synchronize();
+	return *(volatile seqcount *)seq != start;
+}
+
+static inline void
+write_seqbegin(seqcount *seq)
+{
+	(*(volatile seqcount *)seq)++;
+	__sync_synchronize();
+}
+
+static inline void
+write_seqend(seqcount *seq)
 {
-	return EBUSY;
+	__sync_synchronize();
+	(*(volatile seqcount *)seq)++;
 }
 
-#endif/**/
+#endif/*__GENERIC_SPINLOCK_H__*/
@@ -0,0 +1,190 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __GENERIC_WHEEL_H__
+#define __GENERIC_WHEEL_H__
+
+#include <sys/compiler.h>
+#include <list.h>
+
+/*
+ * Hierarchical timing wheel. The first level has 256 slots of one tick,
+ * every upper level 64 slots covering the whole previous level, so five
+ * levels cover 2^32 ticks. A timer is queued in the slot of the level its
+ * distance from the current tick falls into and moves one level down each
+ * time the lower level wraps around, adding and removing timers is O(1).
+ *
+ * wheel_run() fires at most @budget timers per call, the rest stays queued
+ * and is fired by the next call, so a burst of timers expiring in the same
+ * tick never stalls the caller.
+ */
+
+#define WHEEL_BITS0  8
+#define WHEEL_BITS   6
+#define WHEEL_SIZE0  (1U << WHEEL_BITS0)
+#define WHEEL_SIZE   (1U << WHEEL_BITS)
+#define WHEEL_MASK0  (WHEEL_SIZE0 - 1)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+struct wheel_timer {
+	struct node node;
+	u64 expires;
+};
+
+struct wheel {
+	u64 base;
+	u32 count;
+	struct dlist tv0[WHEEL_SIZE0];
+	struct dlist tv[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+typedef void (*wheel_fn_t)(void *ctx, struct wheel_timer *timer);
+
+static inline void
+wheel_init(struct wheel *wheel, u64 base)
+{
+	wheel->base = base;
+	wheel->count = 0;
+	for (unsigned int i = 0; i < WHEEL_SIZE0; i++)
+		dlist_init(&wheel->tv0[i]);
+	for (unsigned int l = 0; l < WHEEL_LEVELS; l++)
+		for (unsigned int i = 0; i < WHEEL_SIZE; i++)
+			dlist_init(&wheel->tv[l][i]);
+}
+
+static inline void
+wheel_timer_init(struct wheel_timer *timer)
+{
+	node_init(&timer->node);
+	timer->expires = 0;
+}
+
+static inline int
+wheel_pending(struct wheel_timer *timer)
+{
+	return timer->node.next != NULL;
+}
+
+static inline struct dlist *
+wheel_slot(struct wheel *wheel, u64 expires)
+{
+	if (expires < wheel->base)
+		return &wheel->tv0[wheel->base & WHEEL_MASK0];
+
+	u64 delta = expires - wheel->base;
+	if (delta < WHEEL_SIZE0)
+		return &wheel->tv0[expires & WHEEL_MASK0];
+
+	unsigned int shift = WHEEL_BITS0;
+	for (unsigned int l = 0; l < WHEEL_LEVELS - 1; l++, shift += WHEEL_BITS)
+		if (delta < (1ULL << (shift + WHEEL_BITS)))
+			return &wheel->tv[l][(expires >> shift) & WHEEL_MASK];
+
+	if (delta > 0xffffffffULL)
+		expires = wheel->base + 0xffffffffULL;
+	return &wheel->tv[WHEEL_LEVELS - 1][(expires >> shift) & WHEEL_MASK];
+}
+
+static inline void
+wheel_add(struct wheel *wheel, struct wheel_timer *timer, u64 expires)
+{
+	timer->expires = expires;
+	dlist_add_tail(wheel_slot(wheel, expires), &timer->node);
+	wheel->count++;
+}
+
+static inline void
+wheel_del(struct wheel *wheel, struct wheel_timer *timer)
+{
+	if (!wheel_pending(timer))
+		return;
+
+	dlist_del(&timer->node);
+	node_init(&timer->node);
+	wheel->count--;
+}
+
+static inline void
+wheel_mod(struct wheel *wheel, struct wheel_timer *timer, u64 expires)
+{
+	wheel_del(wheel, timer);
+	wheel_add(wheel, timer, expires);
+}
+
+/* requeues the timers of the upper level slot into the lower levels */
+static inline unsigned int
+wheel_cascade(struct wheel *wheel, unsigned int level)
+{
+	unsigned int shift = WHEEL_BITS0 + level * WHEEL_BITS;
+	unsigned int index = (wheel->base >> shift) & WHEEL_MASK;
+	struct dlist *list = &wheel->tv[level][index];
+	struct node *node;
+
+	while ((node = dlist_head(list))) {
+		dlist_del(node);
+		struct wheel_timer *timer;
+		timer = __container_of(node, struct wheel_timer, node);
+		dlist_add_tail(wheel_slot(wheel, timer->expires), node);
+	}
+
+	return index;
+}
+
+/*
+ * Fires the timers expired up to tick @now, returns the number of timers
+ * fired. The timer is dequeued before @fn is called, @fn may queue it again.
+ */
+
+static inline unsigned int
+wheel_run(struct wheel *wheel, u64 now, unsigned int budget, wheel_fn_t fn,
+          void *ctx)
+{
+	unsigned int fired = 0;
+
+	while (wheel->base <= now) {
+		struct dlist *list = &wheel->tv0[wheel->base & WHEEL_MASK0];
+		struct node *node;
+
+		while ((node = dlist_head(list))) {
+			if (fired == budget)
+				return fired;
+
+			dlist_del(node);
+			node_init(node);
+			wheel->count--;
+			fired++;
+			fn(ctx, __container_of(node, struct wheel_timer, node));
+		}
+
+		if (!(++wheel->base & WHEEL_MASK0))
+			for (unsigned int l = 0; l < WHEEL_LEVELS; l++)
+				if (wheel_cascade(wheel, l))
+					break;
+	}
+
+	return fired;
+}
+
+#endif/*__GENERIC_WHEEL_H__*/
@@ -4,6 +4,10 @@
 #include <list.h>
 #include <mem/page.h>
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
 static inline u64
 pages_total_bytes(unsigned int bits, unsigned int page_bits, unsigned int total)
 {
@@ -18,6 +22,7 @@ pages_alloc(struct pages *pages, int prot, int mode,
 	pages->list  = 0;
 	pages->total = pages->avail = total;
 	pages->shift = page_bits;
+	pages->hdr   = NULL;
 
 	pages->page = mmap(NULL, pages->size, prot, mode, -1, 0);
 	if (pages->page == MAP_FAILED)
@@ -42,5 +47,81 @@ pages_reset(struct pages *pages)
 int
 pages_free(struct pages *pages)
 {
-	return munmap(pages->page, pages->size);
+	if (!pages->hdr)
+		return munmap(pages->page, pages->size);
+
+	pages_sync(pages, MS_SYNC);
+	pages->hdr->clean = 1;
+	msync(pages->hdr, CPU_PAGE_SIZE, MS_SYNC);
+	return munmap(pages->hdr, pages->size);
+}
+
+int
+pages_open(struct pages *pages, const char *name, int prot, 
+           int page_bits, int total)
+{
+	int fd, kept = 0;
+	if ((fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return -1;
+
+	u64 size = CPU_PAGE_SIZE + ((u64)total << page_bits);
+	off_t end = lseek(fd, 0, SEEK_END);
+	if (end == -1 || ((u64)end != size && ftruncate(fd, size) == -1))
+		goto failed;
+
+	struct pages_hdr *hdr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto failed;
+
+	close(fd);
+	kept = hdr->magic == PAGE_HDR_MAGIC && hdr->shift == (u32)page_bits &&
+	       hdr->total == (u32)total && hdr->size == size;
+
+	pages->hdr   = hdr;
+	pages->size  = size;
+	pages->list  = 0;
+	pages->total = pages->avail = total;
+	pages->shift = page_bits;
+	pages->page  = (struct page *)((byte *)hdr + CPU_PAGE_SIZE);
+
+	if (!kept) {
+		*hdr = (struct pages_hdr) {
+			.magic = PAGE_HDR_MAGIC, .shift = page_bits, 
+			.total = total, .size = size
+		};
+		pages_reset(pages);
+	}
+
+	return kept;
+failed:
+	close(fd);
+	return -1;
+}
+
+void
+pages_rebuild(struct pages *pages, int (*used)(struct page *, void *), 
+              void *ctx)
+{
+	pages->list  = (u32)~0U;
+	pages->avail = 0;
+
+	for (u32 index = pages->total; index--; ) {
+		struct page *page = get_page(pages, index);
+		if (used(page, ctx))
+			continue;
+		page->avail = pages->list;
+		pages->list = index;
+		pages->avail++;
+	}
+}
+
+int
+pages_sync(struct pages *pages, int flags)
+{
+	if (!pages->hdr)
+		return 0;
+
+	pages->hdr->clean = 0;
+	pages->hdr->synced = time(NULL);
+	return msync(pages->hdr, pages->size, flags);
 }
@@ -39,6 +39,7 @@
 __BEGIN_DECLS
 
 struct page;
+struct pages_hdr;
 struct pages {
 	u64 size;
 	u32 list;             /* list of free pages */
@@ -46,8 +47,19 @@ struct pages {
 	u32 total;            /* number of pages in map                    */
 	u32 shift;            /* page size aligned to power of 2           */
 	struct page *page;
+	struct pages_hdr *hdr;/* header of file backed map or NULL         */
 } _align_max;
 
+/* first page of the file backed map */
+struct pages_hdr {
+	u32 magic;
+	u32 shift;
+	u32 total;
+	u32 clean;            /* the map was synced and closed             */
+	u64 size;
+	u64 synced;           /* time of the last pages_sync()             */
+};
+
 struct page {
 	u32 avail;            /* linked list of available pages            */
 	u32 padding;
@@ -138,6 +150,25 @@ pages_reset(struct pages *pages);
 int
 pages_free(struct pages *pages);
 
+/*
+ * Maps the pages shared with the file @name. Returns 1 when the file holds
+ * pages of the same geometry, their content is kept and the caller rebuilds
+ * the free list with pages_rebuild(). Returns 0 when the file was created
+ * or reset and -1 on failure.
+ */
+
+int
+pages_open(struct pages *pages, const char *name, int prot, 
+           int page_bits, int total);
+
+/* rebuilds the free list from the pages for which @used returns 0 */
+void
+pages_rebuild(struct pages *pages, int (*used)(struct page *, void *), 
+              void *ctx);
+
+int
+pages_sync(struct pages *pages, int flags);
+
 _unused static unsigned long
 pages2mb(u32 shift, unsigned long pages)
 {
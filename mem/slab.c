@@ -1,6 +1,101 @@
+/*
+ * High performance, generic and type-safe memory management
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015, 2016, 2017, 2018, 2019       Daniel Kubec <niel@rtfm.cz> 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"),to deal 
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sys/compiler.h>
+#include <sys/log.h>
+#include <list.h>
 #include <mem/slab.h>
+#include <stdlib.h>
+
+/* the free list link is kept behind the object */
+static inline struct snode *
+slab_node(struct mem_slab *slab, void *obj)
+{
+	return (struct snode *)((u8 *)obj + slab->size);
+}
+
+static inline void *
+slab_obj(struct mem_slab *slab, struct snode *node)
+{
+	return (u8 *)node - slab->size;
+}
 
 void
-memslab_init(void)
+mem_slab_init(struct mem_slab *slab, size_t size, unsigned int limit,
+              void (*fini)(void *obj))
 {
+	slab->free = NULL;
+	slab->size = align_to(size, sizeof(void *));
+	slab->count = 0;
+	slab->limit = limit;
+	slab->fini = fini;
+}
+
+void *
+mem_slab_alloc(struct mem_slab *slab)
+{
+	struct snode *node = slab->free;
+	if (node) {
+		slab->free = node->next;
+		slab->count--;
+		return slab_obj(slab, node);
+	}
+
+	void *obj = calloc(1, slab->size + sizeof(struct snode));
+	if (!obj)
+		die("Can not allocate memory size=%jd", (intmax_t)slab->size);
+	return obj;
+}
+
+void
+mem_slab_free(struct mem_slab *slab, void *obj)
+{
+	if (slab->count >= slab->limit) {
+		if (slab->fini)
+			slab->fini(obj);
+		free(obj);
+		return;
+	}
+
+	struct snode *node = slab_node(slab, obj);
+	node->next = slab->free;
+	slab->free = node;
+	slab->count++;
+}
+
+void
+mem_slab_destroy(struct mem_slab *slab)
+{
+	while (slab->free) {
+		void *obj = slab_obj(slab, slab->free);
+		slab->free = slab->free->next;
+		if (slab->fini)
+			slab->fini(obj);
+		free(obj);
+	}
+
+	slab->count = 0;
 }
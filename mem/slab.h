@@ -1,11 +1,64 @@
+/*
+ * High performance, generic and type-safe memory management
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015, 2016, 2017, 2018, 2019       Daniel Kubec <niel@rtfm.cz> 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"),to deal 
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
 #ifndef __MEM_SLAB_H__
 #define __MEM_SLAB_H__
 
+#include <sys/compiler.h>
+#include <list.h>
+
+/*
+ * Cache of objects of one size. Freed objects are kept on a free list and
+ * handed out again while they are still hot in the cache, up to @limit of
+ * them, the others are released by @fini and freed.
+ *
+ * A slab is not locked, it is meant to be used by one thread. Each object
+ * is allocated on its own, so it can be freed to the slab of other thread.
+ * New objects are zeroed, recycled ones keep their contents.
+ */
+
 struct mem_slab {
-	int unused;
+	struct snode *free;
+	size_t size;
+	unsigned int count;
+	unsigned int limit;
+	void (*fini)(void *obj);
 };
 
 void
-memslab_init(void);
+mem_slab_init(struct mem_slab *slab, size_t size, unsigned int limit,
+              void (*fini)(void *obj));
+
+void *
+mem_slab_alloc(struct mem_slab *slab);
+
+void
+mem_slab_free(struct mem_slab *slab, void *obj);
+
+void
+mem_slab_destroy(struct mem_slab *slab);
 
 #endif
@@ -5,10 +5,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
 #include <httpd/ap_config.h>
 #include <httpd/ap_socache.h>
 #include <apr_strings.h>
 #include <apr_escape.h>
+#include <apr_thread_proc.h>
 #include <httpd/httpd.h>
 #include <httpd/http_config.h>
 #include <httpd/http_connection.h>
@@ -29,6 +31,7 @@
 /* AAA abstraction */
 #include <mem/stack.h>
 #include <aaa/lib.h>
+#include <aaa/authz.h>
 #include <crypto/sha1.h>
 #include <crypto/hex.h>
 #include <crypto/abi/ssl.h>
@@ -40,6 +43,21 @@ APLOG_USE_MODULE(authnz_ssl);
 APR_OPTIONAL_FN_TYPE(ssl_is_https)         *is_https;
 APR_OPTIONAL_FN_TYPE(ssl_var_lookup)       *ssl_var_lookup;
 
+/*
+ * The Require group rules of all servers and directories share one compiled
+ * rule set, the roles of the session are evaluated into req->roles from the
+ * view of the request on the first check and each check is a mask test.
+ */
+
+static struct aaa_authz *authz = NULL;
+
+/*
+ * Each worker thread binds sessions with its own aaa context and transport,
+ * created on first use and freed when the thread exits.
+ */
+
+static apr_threadkey_t *aaa_key = NULL;
+
 static const command_rec commands[] = {
 	AP_INIT_FLAG("AAA", ap_set_flag_slot,
 	             (void *)APR_OFFSETOF(struct dir, enabled),
@@ -58,6 +76,13 @@ static const command_rec commands[] = {
  * @ingroup hooks
  */
 
+static apr_status_t
+view_cleanup(void *view)
+{
+	aaa_view_unref(view);
+	return APR_SUCCESS;
+}
+
 static int
 create_request(request_rec *r);
 
@@ -76,16 +101,35 @@ log_write(const char *pref, const char *msg)
  * @param s The list of server_recs in this server
  */
 
+static void
+thread_aaa_free(void *aaa)
+{
+	aaa_free(aaa);
+}
+
+static struct aaa *
+thread_aaa(void)
+{
+	void *aaa = NULL;
+	apr_threadkey_private_get(&aaa, aaa_key);
+	if (aaa)
+		return aaa;
+
+	aaa = aaa_new(AAA_ENDPOINT_SERVER, 0);
+	apr_threadkey_private_set(aaa, aaa_key);
+	return aaa;
+}
+
 static void
 child_init(apr_pool_t *p, server_rec *s)
 {
 	log_verbose = 4;
 	log_set_handler(log_write);
+	apr_threadkey_private_create(&aaa_key, thread_aaa_free, p);
 	apr_pool_cleanup_register(p, s, child_fini, child_fini);
 
 	for (; s; s = s->next) {
 		struct srv *srv = ap_srv_config_get(s);
-		srv->aaa = aaa_new(AAA_ENDPOINT_SERVER, 0);
 		srv->mod_ssl = ap_find_linked_module("mod_ssl.c");
 		srv->mod_event = ap_find_linked_module("mod_mpm_event.c");
 		apr_thread_mutex_create(&srv->mutex, APR_THREAD_MUTEX_DEFAULT,p);
@@ -101,14 +145,17 @@ child_init(apr_pool_t *p, server_rec *s)
 static apr_status_t
 child_fini(void *ctx)
 {
-	server_rec *s = (server_rec *)ctx;
-	for (; s; s = s->next) {
-		struct srv *srv = ap_srv_config_get(s);
-		if (srv->aaa)
-			aaa_free(srv->aaa);
-		srv->aaa = NULL;
-	}
+	void *aaa = NULL;
+	if (!aaa_key)
+		return 0;
+
+	/* the destructor does not run for the thread deleting the key */
+	apr_threadkey_private_get(&aaa, aaa_key);
+	if (aaa)
+		aaa_free(aaa);
 
+	apr_threadkey_private_delete(aaa_key);
+	aaa_key = NULL;
 	return 0;
 }
 
@@ -153,7 +200,13 @@ create_request(request_rec *r)
 		return DECLINED;
 
 	struct req *parent = ap_req_config_get(r->main);
-	req->attrs = parent->attrs;
+	if (parent->view) {
+		req->view = aaa_view_ref(parent->view);
+		apr_pool_cleanup_register(r->pool, req->view, view_cleanup,
+		                          apr_pool_cleanup_null);
+	}
+
+	req->roles = parent->roles;
 	req->user.name = parent->user.name;
 	req->user.id = parent->user.id;
 
@@ -263,42 +316,31 @@ post_read_request(request_rec *r)
 		return HTTP_INTERNAL_SERVER_ERROR;
 	}
 
-	apr_thread_mutex_lock(srv->mutex);
-
 	/* This is evil hack and workaround regarding shared SSL* object between 
 	 * client and proxy connection. */
+	apr_thread_mutex_lock(srv->mutex);
 	if (!conn->has_id) {
 		ssl_get_sess_id(conn->ssl, conn->tls_id, 64);
 		conn->has_id = 1;
 	}
+	apr_thread_mutex_unlock(srv->mutex);
 
-	struct aaa *a = srv->aaa;
+	struct aaa *a = thread_aaa();
 	aaa_reset(a);
 	aaa_attr_set(a, "sess.id", (char *)conn->tls_id);
 	r_debug(r, "%s() tls.id: %s", __func__, (char *)conn->tls_id);
 
-	if (aaa_bind(a) < 0)
-		goto declined;
-
-	req->attrs = apr_table_make(r->pool, 64); 
-	for (const s8 *v, *k = aaa_attr_first(a, ""); k; k = aaa_attr_next(a)) {
-		if (!(v = aaa_attr_get(a, k)))
-			continue;
-		apr_table_set(req->attrs, k, v);
-		r_debug(r, "%s() %s: %s", __func__, k, v);
-	}
-
-	req->user.id = aaa_attr_get(a, "user.id");
-	req->user.name = aaa_attr_get(a, "user.name");
-	if (!req->user.id || !*req->user.id)
-		goto declined;
-
-	aaa_touch(a);
+	/* bind, extend and store the session in one round trip */
+	if (aaa_exec(a, "bind;touch;commit") < 0)
+		return DECLINED;
 
-declined:
-	aaa_commit(a);
+	/* the request keeps the attributes, the context is free to be reused */
+	req->view = aaa_view(a);
+	apr_pool_cleanup_register(r->pool, req->view, view_cleanup,
+	                          apr_pool_cleanup_null);
 
-	apr_thread_mutex_unlock(srv->mutex);
+	req->user.id = aaa_view_get(req->view, "user.id");
+	req->user.name = aaa_view_get(req->view, "user.name");
 	return DECLINED;
 }
 
@@ -480,26 +522,26 @@ header_attr_set(request_rec *r, const char *x, const char *key, const char *val)
 	apr_table_set(r->subprocess_env, k, v);
 }
 
+static int
+header_attr_walk(void *ctx, const char *key, const char *val)
+{
+	request_rec *r = ctx;
+	header_attr_set(r, "aaa", key, val);
+	if (r->proxyreq == PROXYREQ_REVERSE)
+		header_attr_set(r, "ajp.aaa", key, val);
+	return 0;
+}
+
 static int
 header_parser(request_rec *r)
 {
 	struct req *req = ap_req_config_get(r);
 	r_debug(r, "%s(%pp:%pp) uri: %s", __func__, r, r->main, r->uri);
 
-	if (!req->attrs || apr_is_empty_table(req->attrs))
+	if (!req->view)
 		return DECLINED;
-	const apr_array_header_t *tarr = apr_table_elts(req->attrs);
-	const apr_table_entry_t *telts = (const apr_table_entry_t*)tarr->elts;
-
-	for (int i = 0; i < tarr->nelts; i++) {
-		//r_debug(r, "%s() uri: %s %s: <%s>", __func__, r->uri, 
-		  //      telts[i].key, telts[i].val);
 
-		header_attr_set(r, "aaa", telts[i].key, telts[i].val);
-		if (r->proxyreq != PROXYREQ_REVERSE)
-			continue;
-		header_attr_set(r, "ajp.aaa", telts[i].key, telts[i].val);
-	}
+	aaa_view_walk(req->view, header_attr_walk, r);
 
 	if (!req->user.name || !*req->user.name)
 		return DECLINED;
@@ -508,55 +550,52 @@ header_parser(request_rec *r)
 	return DECLINED;
 }
 
-struct authz_rule {
-	const char *org;
-	const char *group;
-	const char *role;
-};
+static apr_status_t
+authz_cleanup(void *ctx)
+{
+	if (authz)
+		aaa_authz_free(authz);
+	authz = NULL;
+	return APR_SUCCESS;
+}
 
 static authz_status
 authz_require_group_check(request_rec *r, const char *line, const void *parsed)
 {
 	struct req *req = ap_req_config_get(r);
-	struct authz_rule *rule = (struct authz_rule *)parsed;
+	const struct aaa_authz_rule *rule = parsed;
 
-	if (!r->user || !req->attrs || apr_is_empty_table(req->attrs))
+	if (!r->user || !req->view)
 		return AUTHZ_DENIED_NO_USER;
 
-	char *path = printfa("acct.%s.roles[]", rule->group);
-	const char *group = apr_table_get(req->attrs, path);
-	if (!group)
-		return AUTHZ_DENIED;
-	if (!rule->role)
-		return AUTHZ_GRANTED;
-
-	char *t, *ln = strdupa(group);
-	for (char *p = strtok_r(ln, " ", &t); p; p = strtok_r(NULL, " ", &t))
-		if (!strcmp(rule->role, p))
-			return AUTHZ_GRANTED;
+	if (!req->roles) {
+		req->roles = apr_pcalloc(r->pool, authz->groups * sizeof(u64));
+		aaa_authz_eval_view(authz, req->view, req->roles);
+	}
 
-	return AUTHZ_DENIED;
+	return aaa_authz_check(rule, req->roles) ? AUTHZ_GRANTED: AUTHZ_DENIED;
 }
 
 static const char *
 authz_require_group_parse(cmd_parms *cmd, const char *line, const void **parsed)
 {
-	apr_pool_t *p = cmd->pool;
-
 	if (!line || !*line)
 		return "Require group does take arguments";
-	
-	int len = strlen(line);
-	char *l = apr_pcalloc(p, len + 1);
-	strncpy(l, line, len);
 
-	char *c = strchr(l, ':');
-	if (c) *c = 0;
+	if (!authz) {
+		authz = aaa_authz_new();
+		apr_pool_cleanup_register(cmd->pool, NULL, authz_cleanup,
+		                          apr_pool_cleanup_null);
+	}
 
-	struct authz_rule *rule = apr_pcalloc(p, sizeof(*rule));
-	rule->group = apr_pstrdup(p, l);
-	rule->role = c ? apr_pstrdup(p, c + 1): NULL;
-	rule->org = apr_pstrdup(p, line);
+	struct aaa_authz_rule *rule = apr_pcalloc(cmd->pool, sizeof(*rule));
+	int rv = aaa_authz_compile(authz, line, rule);
+	if (rv == -ENOSPC)
+		return apr_psprintf(cmd->pool, "Require group %s has more than %d "
+		                    "roles in its group", line, AAA_AUTHZ_ROLES);
+	if (rv)
+		return apr_psprintf(cmd->pool, "Require group %s is invalid, "
+		                    "expected group or group:role[,role...]", line);
 
 	*parsed = rule;
 	return NULL;
@@ -92,7 +92,6 @@
 
 struct srv {
 	void *ctx;
-	struct aaa *aaa;
 	int tls_aaa_capability;
 	int pid;
 	const char *aaa_id;
@@ -103,7 +102,7 @@ struct srv {
 	module *mod_mpm;
 	module *mod_mpm_prefork;
 	module *mod_event;
-	apr_thread_mutex_t *mutex;
+	apr_thread_mutex_t *mutex;         /* tls id of shared connections */
 
 };
 
@@ -119,7 +118,8 @@ struct user {
 
 struct req {
     request_rec *r;
-    apr_table_t* attrs;
+    struct aaa_view *view;
+    uint64_t *roles;
     struct user user;
     char *uri;
     char *sid;
@@ -9,6 +9,7 @@
 #include <sys/log.h>
 #include <aaa/lib.h>
 #include <aaa/prv.h>
+#include <aaa/authz.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,6 +32,8 @@ struct ovpn_ctxt {
 	struct mm_pool *mp_api;
 	enum ovpn_endpoint type;
 	int mask;
+	struct aaa_authz *authz;        /* openaaa_group[:openaaa_role] */
+	struct aaa_authz_rule rule;
 };
 
 struct ovpn_sess {
@@ -129,6 +132,16 @@ openvpn_plugin_open_v3(const int version,
 
 	ovpn->mp_api = mm_pool_create(CPU_PAGE_SIZE, 0);
 	ovpn->mp = mp;
+	ovpn->authz = NULL;
+	if (group) {
+		const char *rule = role ? printfa("%s:%s", group, role): group;
+		ovpn->authz = aaa_authz_new();
+		if (aaa_authz_compile(ovpn->authz, rule, &ovpn->rule)) {
+			error("invalid authorization rule %s", rule);
+			aaa_authz_free(ovpn->authz);
+			ovpn->authz = NULL;
+		}
+	}
 	ovpn->type = envp_get("remote_1", args->envp) ? VPN_CLIENT : VPN_SERVER;
 
 	switch(ovpn->type) {
@@ -195,11 +208,12 @@ openvpn_auth_user_verify(const int version,
 }
 
 static inline int
-authz_group(struct aaa *aaa, const char *key, const char *g, const char *role)
+authz_group(struct ovpn_ctxt *ovpn, struct aaa *aaa, const char *key)
 {
-	if (!g)
+	if (!ovpn->authz)
 		return OPENVPN_PLUGIN_FUNC_ERROR;
 
+	u64 roles[ovpn->authz->groups];
 	for (int i = 0; i < 10; i++) {
 		sleep(1);
 
@@ -213,23 +227,14 @@ authz_group(struct aaa *aaa, const char *key, const char *g, const char *role)
 
 		debug1("user.id: %s", uid);
 
-		char *path = printfa("acct.%s.roles[]", g);
-		const char *acct = aaa_attr_get(aaa, path);
-		if (!acct || !*acct)
+		/* the group attribute may not be set yet or be empty */
+		aaa_authz_eval(ovpn->authz, aaa, roles);
+		if (!roles[ovpn->rule.group])
 			continue;
 
-		debug1("%s: %s", path, acct);
-
-		if (!role)
+		if (aaa_authz_check(&ovpn->rule, roles))
 			return OPENVPN_PLUGIN_FUNC_SUCCESS;
 
-		char *t, *ln = strdupa(acct);
-		for (char *p = strtok_r(ln, " ", &t); p; 
-		           p = strtok_r(NULL, " ", &t)) {
-			if (!strcmp(role, p))
-				return OPENVPN_PLUGIN_FUNC_SUCCESS;
-		}
-
 		return OPENVPN_PLUGIN_FUNC_ERROR;
 	}
 
@@ -273,10 +278,7 @@ openvpn_plugin_func_v3(const int version,
 		if (!key || !*key)
 			return OPENVPN_PLUGIN_FUNC_ERROR;
 
-		const char *group = envp_get("openaaa_group", args->envp);
-		const char *role  = envp_get("openaaa_role", args->envp);
-
-		return authz_group(aaa, key, group, role);
+		return authz_group(ovpn, aaa, key);
 	default:
 		goto failed;
 	}
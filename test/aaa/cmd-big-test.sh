@@ -23,19 +23,19 @@ echo "user.email: $user_email"
 echo "user.id: $user_id"
 
 echo "bind() sess.id: $sess_id"
-req="${op_bind}\nsess.id:${sess_id}\n"
+req="sess.id:${sess_id}\n${op_bind}\n"
 echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
 
 echo "login() sess.id: $sess_id"
-req="${op_commit}\nsess.id:${sess_id}\nuser.id:${user_id}\nuser.name:${user_name}\nuser.email:${user_email}\nuser.gender:${user_gender}\nuser.ip:${user_ip}\nauth.type:tls\nauth.trust:none\n"
+req="sess.id:${sess_id}\n${op_commit}\nuser.id:${user_id}\nuser.name:${user_name}\nuser.email:${user_email}\nuser.gender:${user_gender}\nuser.ip:${user_ip}\nauth.type:tls\nauth.trust:none\n"
 echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
 
 echo "bind() sess.id: $sess_id"
-req="${op_bind}\nsess.id:${sess_id}\n"
+req="sess.id:${sess_id}\n${op_bind}\n"
 #echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
@@ -44,7 +44,7 @@ chk_user_name=$(echo "$res" | grep -o 'user.name:[^,]*' | sed -e 's/user.name://
 chk_sess_id=$(echo "$res" | grep -o 'sess.id:[^,]*' | sed -e 's/sess.id://g')
 
 echo "update() sess.id: $sess_id"
-req="${op_commit}\nsess.id:${sess_id}\nauth.result:${auth_result}\n"
+req="sess.id:${sess_id}\n${op_commit}\nauth.result:${auth_result}\n"
 #echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
@@ -9,13 +9,13 @@ op_commit="msg.op:commit\nmsg.id:1"
 op_bind="msg.op:bind\nmsg.id:1"
 
 echo "bind() sess.id: $sess_id"
-req="${op_bind}\nsess.id:${sess_id}\n"
+req="sess.id:${sess_id}\n${op_bind}\n"
 echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
 
 echo "login() sess.id: $sess_id"
-req="${op_commit}\nsess.id:${sess_id}\nuser.id:${user_id}\nuser.name:${user_name}\nauth.result:${auth_result}\n"
+req="sess.id:${sess_id}\n${op_commit}\nuser.id:${user_id}\nuser.name:${user_name}\nauth.result:${auth_result}\n"
 echo "req: $req"
 res=$(unbuffer printf "$req" | nc -4u -w1 $OPENAAA_SERVICE 8888)
 echo "res: $(echo "$res" | sed -e 'H;${x;s/\n/,/g;s/^,//;p;};d')"
@@ -7,6 +7,55 @@
 #include <dict.h>
 #include <version.h>
 
+#include <stdio.h>
+#include <unix/timespec.h>
+
+/*
+ * The dict before the hash index, a linear scan over the list and the
+ * selection sort, kept for the comparison.
+ */
+
+struct ldict {
+	struct dlist list;
+	struct mm *mm;
+};
+
+static struct attr *
+ldict_lookup(struct ldict *dict, const char *key, int create)
+{
+	dict_for_each(a, dict->list)
+		if (!strcmp(a->key, key))
+			return a;
+	if (!create)
+		return NULL;
+
+	struct attr *a = mm_alloc(dict->mm, sizeof(*a));
+	a->key = mm_strdup(dict->mm, key);
+	a->flags = 0;
+	dlist_add(&dict->list, &a->node);
+	return a;
+}
+
+static void
+ldict_sort(struct ldict *dict)
+{
+	struct node *x, *y, *z;
+	for (x = dlist_head(&dict->list); x; ) {
+		for (z = y = x; (y = dlist_next(&dict->list, y)); ) {
+			struct attr *a = __container_of(y, struct attr, node);
+			struct attr *b = __container_of(z, struct attr, node);
+			if (strcmp(a->key, b->key) < 0)
+				z = y;
+		}
+		if (x == z)
+			x = dlist_next(&dict->list, x);
+		else {
+			dlist_del(z);
+			dlist_add_before(z, x);
+		}
+	}
+}
+
 void
 dict_test1(struct dict *x)
 {
@@ -26,8 +75,116 @@ dict_test1(struct dict *x)
 	dict_dump(x);
 }
 
-int 
-main(int argc, char *argv[]) 
+static int
+dict_test2(struct dict *x)
+{
+	char key[64];
+	for (unsigned int i = 0; i < 200; i++) {
+		snprintf(key, sizeof(key), "acct.app.roles[%u]", i);
+		dict_set(x, key, key);
+	}
+
+	for (unsigned int i = 0; i < 200; i += 2) {
+		snprintf(key, sizeof(key), "acct.app.roles[%u]", i);
+		dict_set(x, key, NULL);
+	}
+
+	for (unsigned int i = 0; i < 200; i++) {
+		snprintf(key, sizeof(key), "acct.app.roles[%u]", i);
+		const char *val = dict_get(x, key);
+		if ((i & 1) && (!val || strcmp(val, key)))
+			return -1;
+		if (!(i & 1) && val)
+			return -1;
+	}
+
+	dict_sort(x);
+	const char *prev = "";
+	unsigned int count = 0;
+	dict_for_each(a, x->list) {
+		if (strcmp(prev, a->key) > 0)
+			return -1;
+		prev = a->key;
+		count++;
+	}
+
+	return count == 100 && x->count == 100 ? 0: -1;
+}
+
+static int
+dict_test3(struct dict *x)
+{
+	struct attr *a = dict_lookup(x, "acct.app.roles[]", 1);
+	a->val = "user admin  user guest";
+
+	if (!dict_has_value(x, a, "admin") || !dict_has_value(x, a, "guest"))
+		return -1;
+	if (dict_has_value(x, a, "root") || dict_has_value(x, a, ""))
+		return -1;
+
+	if (!dict_vals_update(x, a, "root", 0) || dict_vals_update(x, a, "root", 0))
+		return -1;
+	if (!dict_vals_update(x, a, "user", 1) || dict_vals_update(x, a, "user", 1))
+		return -1;
+	if (strcmp(a->val, "admin guest root"))
+		return -1;
+
+	if (!dict_value_has(a->val, "guest") || dict_value_has(a->val, "gues"))
+		return -1;
+	return dict_has_value(x, a, "root") && !dict_has_value(x, a, "user") ? 0: -1;
+}
+
+static void
+dict_bench(unsigned int total, unsigned int iter)
+{
+	struct mm_pool *p = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct dict dict;
+	struct ldict ldict = { .mm = mm_pool(p) };
+	char keys[total][32];
+
+	dict_init(&dict, mm_pool(p));
+	dlist_init(&ldict.list);
+	for (unsigned int i = 0; i < total; i++)
+		snprintf(keys[i], sizeof(keys[i]), "acct.app.roles[%u]", i);
+
+	/* inserted out of order for the sort */
+	for (unsigned int i = 0; i < total; i++) {
+		char *key = keys[(i * 37U) % total];
+		dict_lookup(&dict, key, 1)->val = key;
+		ldict_lookup(&ldict, key, 1)->val = key;
+	}
+
+	unsigned int misses = 0;
+	timestamp_t start = get_timestamp();
+	for (unsigned int i = 0; i < iter; i++)
+		if (!dict_lookup(&dict, keys[(i * 7919U) % total], 0))
+			misses++;
+	_unused float hashed = (get_timestamp() - start) / (float)iter;
+
+	start = get_timestamp();
+	for (unsigned int i = 0; i < iter; i++)
+		if (!ldict_lookup(&ldict, keys[(i * 7919U) % total], 0))
+			misses++;
+	_unused float linear = (get_timestamp() - start) / (float)iter;
+
+	start = get_timestamp();
+	dict_sort(&dict);
+	_unused u64 sorted = get_timestamp() - start;
+
+	start = get_timestamp();
+	ldict_sort(&ldict);
+	_unused u64 lsorted = get_timestamp() - start;
+
+	info("dict attrs=%.3u lookup hash=%.1f ns list=%.1f ns "
+	     "sort merge=%llu ns selection=%llu ns misses=%u", total, hashed,
+	     linear, (unsigned long long)sorted, (unsigned long long)lsorted,
+	     misses);
+
+	mm_pool_destroy(p);
+}
+
+int
+main(int argc, char *argv[])
 {
 	log_open("stdout");
 	log_verbose = 4;
@@ -37,7 +194,19 @@ main(int argc, char *argv[])
 
 	dict_init(&dict, mm_pool(p));
 	dict_test1(&dict);
+	mm_pool_destroy(p);
 
+	p = mm_pool_create(CPU_PAGE_SIZE, 0);
+	dict_init(&dict, mm_pool(p));
+	if (dict_test2(&dict))
+		die("dict delete and sort failed");
+	if (dict_test3(&dict))
+		die("dict value set failed");
 	mm_pool_destroy(p);
+
+	static const unsigned int attrs[] = { 8, 16, 32, 64, 128 };
+	for (unsigned int i = 0; i < array_size(attrs); i++)
+		dict_bench(attrs[i], 1000000);
+
 	return 0;
 }
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/compiler.h>
+#include <sys/log.h>
+#include <mem/slab.h>
+
+struct obj {
+	int id;
+	char data[20];
+};
+
+static unsigned int finis;
+
+static void
+obj_fini(void *obj)
+{
+	struct obj *o = obj;
+	o->id = -1;
+	finis++;
+}
+
+static int
+zeroed(struct obj *o)
+{
+	static const struct obj zero;
+	return !memcmp(o, &zero, sizeof(*o));
+}
+
+static int
+slab_test1(struct mem_slab *slab)
+{
+	struct obj *a = mem_slab_alloc(slab);
+	struct obj *b = mem_slab_alloc(slab);
+	if (!zeroed(a) || !zeroed(b) || a == b)
+		return -1;
+
+	a->id = 1;
+	b->id = 2;
+	mem_slab_free(slab, a);
+	mem_slab_free(slab, b);
+	if (slab->count != 2 || finis)
+		return -1;
+
+	/* the last freed object comes back first and keeps its contents */
+	struct obj *c = mem_slab_alloc(slab);
+	struct obj *d = mem_slab_alloc(slab);
+	if (c != b || d != a || c->id != 2 || d->id != 1 || slab->count)
+		return -1;
+
+	struct obj *e = mem_slab_alloc(slab);
+	if (!zeroed(e) || e == c || e == d)
+		return -1;
+
+	mem_slab_free(slab, c);
+	mem_slab_free(slab, d);
+	mem_slab_free(slab, e);
+	return 0;
+}
+
+static int
+slab_test2(struct mem_slab *slab)
+{
+	struct obj *objs[6];
+	for (unsigned int i = 0; i < array_size(objs); i++)
+		objs[i] = mem_slab_alloc(slab);
+
+	/* objects over the limit are released by fini and freed */
+	for (unsigned int i = 0; i < array_size(objs); i++)
+		mem_slab_free(slab, objs[i]);
+
+	return slab->count == slab->limit && finis == 2 ? 0: -1;
+}
+
+int 
+main(int argc, char *argv[]) 
+{
+	struct mem_slab slab;
+	mem_slab_init(&slab, sizeof(struct obj), 4, obj_fini);
+
+	if (slab_test1(&slab))
+		die("slab reuse failed");
+
+	mem_slab_destroy(&slab);
+	if (slab.count || slab.free || finis != 3)
+		die("slab destroy failed");
+
+	finis = 0;
+	mem_slab_init(&slab, sizeof(struct obj), 4, obj_fini);
+	if (slab_test2(&slab))
+		die("slab limit failed");
+
+	mem_slab_destroy(&slab);
+	if (slab.count || slab.free || finis != 6)
+		die("slab destroy failed");
+
+	info("slab test passed");
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/compiler.h>
+#include <sys/cpu.h>
+#include <sys/log.h>
+#include <list.h>
+#include <mem/alloc.h>
+#include <mem/vm.h>
+#include <hash.h>
+#include <hindex.h>
+
+#include <unix/timespec.h>
+
+/*
+ * Session lookup by sess.id, the fixed 512 bucket hlist table used by the
+ * session store before compared to the open addressing hindex.
+ */
+
+#define SID_LEN 48
+
+struct item {
+	struct hnode node;
+	u64 hash;
+	char sid[SID_LEN];
+};
+
+DEFINE_HASHTABLE(htable, 9);
+
+static struct hindex idx;
+static struct item *items;
+
+static int
+match(void *ctx, u32 ref)
+{
+	return !strcmp((const char *)ctx, items[ref].sid);
+}
+
+static struct item *
+hlist_lookup(const char *sid, u64 hash)
+{
+	struct hlist *list = &htable[hash_u32((u32)hash, 9)];
+	hlist_for_each(list, it) {
+		struct item *item = __container_of(it, struct item, node);
+		if (!strcmp(sid, item->sid))
+			return item;
+	}
+	return NULL;
+}
+
+static void
+populate(unsigned int total)
+{
+	hash_init(htable);
+	hindex_init(&idx, 12);
+
+	for (unsigned int i = 0; i < total; i++) {
+		struct item *item = &items[i];
+		snprintf(item->sid, sizeof(item->sid), "%016x%016x", i * 2654435761U, i);
+		item->hash = hindex_fp(hash_buffer(item->sid, strlen(item->sid)));
+		hnode_init(&item->node);
+		hash_add(htable, &item->node, hash_u32((u32)item->hash, 9));
+		hindex_add(&idx, item->hash, i);
+	}
+}
+
+static void
+test_hindex(unsigned int total, unsigned int iter)
+{
+	unsigned int misses = 0;
+	timestamp_t start = get_timestamp();
+
+	for (unsigned int i = 0; i < iter; i++) {
+		struct item *item = &items[(i * 7919U) % total];
+		if (hindex_find(&idx, item->hash, match, item->sid) == HINDEX_NONE)
+			misses++;
+	}
+
+	u64 delta = get_timestamp() - start;
+	_unused float avg = (delta / (float) iter);
+
+	info("hindex sessions=%.7u lookups=%.7u avg=%.1f ns misses=%u",
+	     total, iter, avg, misses);
+}
+
+static void
+test_hlist(unsigned int total, unsigned int iter)
+{
+	unsigned int misses = 0;
+	timestamp_t start = get_timestamp();
+
+	for (unsigned int i = 0; i < iter; i++) {
+		struct item *item = &items[(i * 7919U) % total];
+		if (!hlist_lookup(item->sid, item->hash))
+			misses++;
+	}
+
+	u64 delta = get_timestamp() - start;
+	_unused float avg = (delta / (float) iter);
+
+	info("hlist  sessions=%.7u lookups=%.7u avg=%.1f ns misses=%u",
+	     total, iter, avg, misses);
+}
+
+static int
+test_delete(unsigned int total)
+{
+	for (unsigned int i = 0; i < total; i += 2)
+		if (hindex_del(&idx, items[i].hash, i))
+			return -1;
+
+	for (unsigned int i = 0; i < total; i++) {
+		u32 ref = hindex_find(&idx, items[i].hash, match, items[i].sid);
+		if ((i & 1) && ref != i)
+			return -1;
+		if (!(i & 1) && ref != HINDEX_NONE)
+			return -1;
+	}
+
+	return idx.count == total / 2 ? 0: -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned int sessions[] = { 1000, 10000, 100000, 1000000 };
+	unsigned int max = sessions[array_size(sessions) - 1];
+
+	log_open("stdout");
+	log_verbose = 1;
+	items = vm_page_alloc(sizeof(*items) * max);
+
+	for (unsigned int i = 0; i < array_size(sessions); i++) {
+		unsigned int total = sessions[i];
+		populate(total);
+
+		test_hindex(total, 1000000);
+		test_hlist(total, total > 10000 ? 1000: 100000);
+
+		if (test_delete(total))
+			die("hindex delete sessions=%u failed", total);
+
+		hindex_free(&idx);
+	}
+
+	vm_page_free(items, sizeof(*items) * max);
+	return 0;
+}